@@ -1,37 +1,368 @@
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_EVENTS 20 // Max events to keep in memory
-#define MSG_LEN 128   // Max message length
+#define MAX_EVENTS 20    // Default ring size (-n)
+#define ARENA_PER_EVENT 16 // Payload arena bytes per ring slot
+#define MSG_LEN 128      // Max message length
+#define CACHE_LINE 64
+#define MAX_BATCH 64     // Largest per-thread publish batch
+#define MAX_PRODUCERS 64 // Producer / load-generator threads
+#define LAT_BUCKETS 4096 // Latency histogram, LAT_NS_PER_BUCKET each
+#define LAT_NS_PER_BUCKET 32
+#define JOURNAL_PATH "events.journal"
+#define JOURNAL_MAGIC 0x314C4E4A  // "JNL1"
+#define JOURNAL_HEADER 4096       // Records start one page in
+#define JOURNAL_GROW 4096         // Minimum records added per file extension
+#define JOURNAL_MAX (1ULL << 26)  // Records the mapping can ever hold
+#define MAX_TYPES 254    // Interned message texts; type 0 = not indexed
+#define TYPE_OTHER 255   // Messages that did not fit in the intern table
+#define INDEX_BLOCK 1024 // Events summarised per index block
+#define QUERY_SHOW 20    // Matches printed per query
+#define TAIL_BUF (64 * 1024)  // Live output is written in chunks this size
+#define TAIL_POLL_NS 20000000 // Live tail wakes every 20 ms
+#define MAX_METRICS 16    // Distinct reading names ("Power", "Voltage", ...)
+#define STAT_SECONDS 300  // Longest rolling window, one bucket per second
+#define STAT_BINS 256     // Value histogram, 8 bins per power of two
+#define STAT_MIN_EXP (-8) // Values below 2^-8 share the first bin
+#define STAT_SHARDS (MAX_PRODUCERS + 1) // Per-thread stats, plus main
 
+// An event as handed to readers; the ring stores it in compact form.
 typedef struct Event {
   int id;
   char time[32];
   char msg[MSG_LEN];
-  struct Event *prev;
-  struct Event *next;
 } Event;
 
+/*
+ * Ring slot guarded by a sequence lock. Event n lives in slot
+ * n % ring_size; seq is 2n+1 while it is being written and 2n+2 once
+ * published, so readers can tell a torn or overwritten slot. The text is
+ * an interned type; only text that did not intern is copied to the arena.
+ * Each slot has a cache line to itself, so producers writing neighbouring
+ * sequences never false-share.
+ */
 typedef struct {
-  Event *head;   // Oldest
-  Event *tail;   // Newest
-  Event *cursor; // Operator position
-  int count;
-  int next_id;
-  int live;
-  int running;
-  pthread_mutex_t lock;
+  alignas(CACHE_LINE) atomic_uint_fast64_t seq;
+  uint64_t off; // Arena position of the text (TYPE_OTHER only)
+  uint32_t when;
+  uint8_t type;
+  uint8_t len;
+} Slot;
+
+typedef struct {
+  Slot *ring;
+  uint64_t ring_size;
+  char *arena; // Byte ring for text that is not interned
+  uint64_t arena_size; // Power of two
+  alignas(CACHE_LINE) atomic_uint_fast64_t arena_head; // Bytes claimed
+  atomic_uint_fast64_t *head; // Next sequence to claim (journal or head_mem)
+  alignas(CACHE_LINE) atomic_uint_fast64_t head_mem;
+  alignas(CACHE_LINE) atomic_uint_fast64_t base; // First sequence not cleared
+  uint64_t origin; // First sequence of this run; earlier ones are journal-only
+  uint64_t cursor; // Operator position (sequence), main thread only
+  atomic_int live;
+  atomic_int running;
 } Log;
 
 Log logg;
 
-void timestamp(char *buf) {
-  time_t t = time(NULL);
-  strftime(buf, 32, "%Y-%m-%d %H:%M:%S", localtime(&t));
+/*
+ * Append-only journal: record n sits at a fixed offset, so the whole file
+ * is mapped once and read or written in place. commit is stored last as
+ * n + 1; a record torn by a crash reads as missing rather than garbage.
+ */
+typedef struct {
+  atomic_uint_fast64_t commit;
+  int64_t when;
+  char msg[MSG_LEN];
+} JournalRecord;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t record_size;
+  alignas(CACHE_LINE) atomic_uint_fast64_t next; // Sequences claimed
+} JournalHeader;
+
+typedef struct {
+  int fd;
+  JournalHeader *hdr; // NULL when running without a journal
+  JournalRecord *recs;
+  atomic_uint_fast64_t capacity; // Records backed by the file
+  atomic_uint_fast64_t dropped;  // Events the journal could not take
+  atomic_int full;               // Set once the first drop is reported
+  pthread_mutex_t grow;
+} Journal;
+
+Journal journal = {.fd = -1, .grow = PTHREAD_MUTEX_INITIALIZER};
+
+size_t journal_span() {
+  return JOURNAL_HEADER + JOURNAL_MAX * sizeof(JournalRecord);
+}
+
+// Maps the journal, creating it if needed. Nothing is replayed.
+int journal_open(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror(path);
+    return 0;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (st.st_size > 0 && st.st_size < JOURNAL_HEADER) ||
+      (st.st_size == 0 && ftruncate(fd, JOURNAL_HEADER) != 0)) {
+    fprintf(stderr, "%s: cannot use as journal\n", path);
+    close(fd);
+    return 0;
+  }
+
+  // Reserve address space for the largest journal; the file grows under it
+  void *map =
+      mmap(NULL, journal_span(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return 0;
+  }
+
+  JournalHeader *hdr = map;
+  if (st.st_size == 0) {
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->record_size = sizeof(JournalRecord);
+    atomic_store(&hdr->next, 0);
+  } else if (hdr->magic != JOURNAL_MAGIC ||
+             hdr->record_size != sizeof(JournalRecord)) {
+    fprintf(stderr, "%s: not a journal\n", path);
+    munmap(map, journal_span());
+    close(fd);
+    return 0;
+  }
+
+  uint64_t cap = st.st_size > JOURNAL_HEADER
+                     ? (st.st_size - JOURNAL_HEADER) / sizeof(JournalRecord)
+                     : 0;
+  journal.fd = fd;
+  journal.hdr = hdr;
+  journal.recs = (JournalRecord *)((char *)map + JOURNAL_HEADER);
+  atomic_store(&journal.capacity, cap);
+  return 1;
+}
+
+void journal_close() {
+  if (!journal.hdr)
+    return;
+  uint64_t dropped = atomic_load(&journal.dropped);
+  if (dropped)
+    fprintf(stderr, "Journal full: %llu events were not journaled\n",
+            (unsigned long long)dropped);
+  uint64_t cap = atomic_load(&journal.capacity);
+  msync(journal.hdr, JOURNAL_HEADER + cap * sizeof(JournalRecord), MS_SYNC);
+  munmap(journal.hdr, journal_span());
+  close(journal.fd);
+  journal.hdr = NULL;
+}
+
+// Makes sure record n is backed by the file; only growth takes the lock.
+int journal_reserve(uint64_t n) {
+  if (n < atomic_load_explicit(&journal.capacity, memory_order_acquire))
+    return 1;
+  if (n >= JOURNAL_MAX)
+    return 0;
+
+  pthread_mutex_lock(&journal.grow);
+  uint64_t cap = atomic_load(&journal.capacity);
+  while (cap <= n) {
+    uint64_t want = cap + (cap > JOURNAL_GROW ? cap : JOURNAL_GROW);
+    if (want > JOURNAL_MAX)
+      want = JOURNAL_MAX;
+    if (ftruncate(journal.fd, JOURNAL_HEADER + want * sizeof(JournalRecord)))
+      break;
+    cap = want;
+  }
+  atomic_store_explicit(&journal.capacity, cap, memory_order_release);
+  pthread_mutex_unlock(&journal.grow);
+  return n < cap;
+}
+
+// Counts an event the journal cannot hold; only the first is reported.
+void journal_drop(uint64_t n) {
+  atomic_fetch_add(&journal.dropped, 1);
+  if (atomic_exchange(&journal.full, 1))
+    return;
+  fprintf(stderr, "\nJournal full at event %llu (%s); "
+                  "later events are kept in the ring only\n",
+          (unsigned long long)n,
+          n >= JOURNAL_MAX ? "record limit reached" : "cannot grow file");
+}
+
+void journal_write(uint64_t n, time_t when, const char *msg) {
+  if (!journal.hdr)
+    return;
+  if (!journal_reserve(n)) {
+    journal_drop(n);
+    return;
+  }
+  JournalRecord *r = &journal.recs[n];
+  r->when = when;
+  strncpy(r->msg, msg, MSG_LEN - 1);
+  r->msg[MSG_LEN - 1] = '\0';
+  atomic_store_explicit(&r->commit, n + 1, memory_order_release);
+}
+
+void format_time(time_t t, char *buf) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  strftime(buf, 32, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+// Reads record n straight from the mapping; only that page is touched.
+int journal_read(uint64_t n, Event *out) {
+  if (!journal.hdr ||
+      n >= atomic_load_explicit(&journal.capacity, memory_order_acquire))
+    return 0;
+  JournalRecord *r = &journal.recs[n];
+  if (atomic_load_explicit(&r->commit, memory_order_acquire) != n + 1)
+    return 0;
+
+  out->id = (int)n;
+  format_time((time_t)r->when, out->time);
+  memcpy(out->msg, r->msg, MSG_LEN);
+  out->msg[MSG_LEN - 1] = '\0';
+  return 1;
+}
+
+/*
+ * Secondary indexes, kept by write_slot(): every message text is interned
+ * to a one-byte type, and each block of INDEX_BLOCK sequences records
+ * which types and which time span it contains. A query matches its text
+ * filter against the few interned texts and skips whole blocks.
+ */
+typedef struct {
+  atomic_uint_fast64_t types[4]; // Bit t set if type t occurs in the block
+  _Atomic uint32_t t_min;        // 0 while the block is empty
+  _Atomic uint32_t t_max;
+} IndexBlock;
+
+/*
+ * The per-sequence arrays exist only with a journal and cover the
+ * journaled sequences; events only the ring holds are matched through
+ * the type and time their slots already carry.
+ */
+typedef struct {
+  _Atomic(char *) names[MAX_TYPES]; // Slot t-1 holds the text of type t
+  atomic_uchar *type;               // Per sequence, NULL without a journal
+  _Atomic uint32_t *when;           // Per sequence, seconds
+  IndexBlock *blocks;
+  atomic_uint_fast64_t history; // Earlier runs' sequences indexed so far
+} Index;
+
+Index idx;
+
+// Reserves the index arrays; pages are only touched as events arrive.
+int index_init() {
+  size_t sizes[3] = {JOURNAL_MAX * sizeof(atomic_uchar),
+                     JOURNAL_MAX * sizeof(_Atomic uint32_t),
+                     JOURNAL_MAX / INDEX_BLOCK * sizeof(IndexBlock)};
+  void *maps[3];
+  for (int k = 0; k < 3; k++) {
+    maps[k] = mmap(NULL, sizes[k], PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (maps[k] == MAP_FAILED) {
+      perror("mmap");
+      return 0;
+    }
+  }
+  idx.type = maps[0];
+  idx.when = maps[1];
+  idx.blocks = maps[2];
+  return 1;
+}
+
+// Lock-free: a new text claims an empty slot by compare-and-swap.
+int intern(const char *msg) {
+  uint32_t h = 2166136261u;
+  for (int k = 0; k < MSG_LEN - 1 && msg[k]; k++)
+    h = (h ^ (uint8_t)msg[k]) * 16777619u;
+
+  char *mine = NULL;
+  for (int probe = 0; probe < MAX_TYPES; probe++) {
+    int slot = (h + probe) % MAX_TYPES;
+    char *cur = atomic_load_explicit(&idx.names[slot], memory_order_acquire);
+    if (!cur) {
+      if (!mine && !(mine = strndup(msg, MSG_LEN - 1)))
+        return TYPE_OTHER;
+      if (atomic_compare_exchange_strong(&idx.names[slot], &cur, mine))
+        return slot + 1;
+    }
+    if (strncmp(cur, msg, MSG_LEN - 1) == 0) {
+      free(mine);
+      return slot + 1;
+    }
+  }
+  free(mine);
+  return TYPE_OTHER;
+}
+
+size_t index_bytes() {
+  if (!idx.type)
+    return 0;
+  uint64_t n = atomic_load(logg.head);
+  if (n > JOURNAL_MAX)
+    n = JOURNAL_MAX;
+  return n * (sizeof(atomic_uchar) + sizeof(_Atomic uint32_t)) +
+         (n / INDEX_BLOCK + 1) * sizeof(IndexBlock);
+}
+
+void index_add(uint64_t n, int t, time_t when) {
+  if (!idx.type || n >= JOURNAL_MAX)
+    return;
+  uint32_t secs = (uint32_t)when;
+  IndexBlock *b = &idx.blocks[n / INDEX_BLOCK];
+
+  atomic_fetch_or(&b->types[t / 64], 1ULL << (t % 64));
+  uint32_t cur = atomic_load(&b->t_min);
+  while ((cur == 0 || secs < cur) &&
+         !atomic_compare_exchange_weak(&b->t_min, &cur, secs))
+    ;
+  cur = atomic_load(&b->t_max);
+  while (secs > cur && !atomic_compare_exchange_weak(&b->t_max, &cur, secs))
+    ;
+
+  atomic_store_explicit(&idx.when[n], secs, memory_order_relaxed);
+  atomic_store_explicit(&idx.type[n], (unsigned char)t, memory_order_release);
+}
+
+/*
+ * Indexes journal records from earlier runs in the background, so the
+ * first query does not stall on the whole journal. Queries over history
+ * that is not indexed yet say so.
+ */
+void *history_thread(void *arg) {
+  (void)arg;
+  uint64_t end = logg.origin;
+  if (end > atomic_load(&journal.capacity))
+    end = atomic_load(&journal.capacity);
+  for (uint64_t n = 0; n < end && atomic_load(&logg.running); n++) {
+    JournalRecord *r = &journal.recs[n];
+    if (atomic_load_explicit(&r->commit, memory_order_acquire) == n + 1)
+      index_add(n, intern(r->msg), (time_t)r->when);
+    if ((n + 1) % INDEX_BLOCK == 0)
+      atomic_store(&idx.history, n + 1);
+  }
+  if (atomic_load(&logg.running))
+    atomic_store(&idx.history, logg.origin);
+  return NULL;
 }
 
 void print_event(Event *e) {
@@ -42,130 +373,927 @@ void print_event(Event *e) {
   printf("[ID:%03d | %s] %s\n", e->id, e->time, e->msg);
 }
 
-void remove_oldest() {
-  if (!logg.head)
+// Oldest sequence still readable (ring or journal) and not cleared.
+uint64_t oldest_seq() {
+  uint64_t head = atomic_load(logg.head);
+  uint64_t base = atomic_load(&logg.base);
+  uint64_t lo = head > logg.ring_size ? head - logg.ring_size : 0;
+  if (journal.hdr)
+    lo = 0;
+  return lo > base ? lo : base;
+}
+
+/*
+ * Copies event n out of the ring; returns 0 if it is gone or not yet
+ * written. Slots are numbered from logg.origin, the first sequence of
+ * this run.
+ */
+int ring_read(uint64_t n, Event *out) {
+  if (n < logg.origin)
+    return 0;
+  uint64_t r = n - logg.origin;
+  Slot *e = &logg.ring[r % logg.ring_size];
+  uint64_t want = 2 * r + 2;
+
+  while (1) {
+    uint64_t s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (s1 == want - 1) {
+      sched_yield(); // Writer is mid-copy; it finishes shortly
+      continue;
+    }
+    if (s1 != want)
+      return 0;
+
+    uint32_t when = e->when;
+    int type = e->type, len = e->len;
+    uint64_t off = e->off;
+    if (type == TYPE_OTHER)
+      for (int k = 0; k < len; k++)
+        out->msg[k] = logg.arena[(off + k) & (logg.arena_size - 1)];
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&e->seq, memory_order_relaxed) != s1)
+      continue;
+
+    if (type == TYPE_OTHER) {
+      // A later writer may have lapped the arena while we copied
+      if (atomic_load(&logg.arena_head) > off + logg.arena_size)
+        return 0;
+      out->msg[len] = '\0';
+    } else {
+      strcpy(out->msg, atomic_load(&idx.names[type - 1]));
+    }
+    out->id = (int)n;
+    format_time((time_t)when, out->time);
+    return 1;
+  }
+}
+
+// Recent events come from the ring, older ones from the journal.
+int read_event(uint64_t n, Event *out) {
+  return ring_read(n, out) || journal_read(n, out);
+}
+
+// Type and time of event n without its text; 0 if unknown or gone.
+int event_meta(uint64_t n, int *type, uint32_t *when) {
+  if (idx.type && n < JOURNAL_MAX) {
+    *type = atomic_load_explicit(&idx.type[n], memory_order_acquire);
+    *when = atomic_load_explicit(&idx.when[n], memory_order_relaxed);
+    return *type != 0;
+  }
+  if (n < logg.origin)
+    return 0;
+  uint64_t r = n - logg.origin;
+  Slot *e = &logg.ring[r % logg.ring_size];
+  uint64_t s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+  *type = e->type;
+  *when = e->when;
+  atomic_thread_fence(memory_order_acquire);
+  return s1 == 2 * r + 2 &&
+         atomic_load_explicit(&e->seq, memory_order_relaxed) == s1;
+}
+
+/*
+ * Rolling statistics for readings of the form "Name: value unit". Each
+ * metric keeps one bucket per second (count, sum, min, max and a log
+ * histogram), reused STAT_SECONDS later, so recording is O(1) and a
+ * window query only merges buckets, never the log.
+ *
+ * Every writing thread owns a shard of buckets, so recording takes no
+ * lock; a bucket's seq is odd while its owner updates it, and the 'a'
+ * command merges consistent copies of all shards.
+ */
+typedef struct {
+  atomic_uint seq;
+  uint32_t second; // Second this bucket holds; stale buckets are reset
+  uint32_t count;
+  double sum, min, max;
+  uint32_t hist[STAT_BINS];
+} StatBucket;
+
+typedef struct {
+  StatBucket buckets[STAT_SECONDS];
+} StatShard;
+
+typedef struct {
+  char name[32];
+  char unit[16];
+  // Allocated by the owning thread on its first reading; the last shard
+  // is shared, under stat_shared_lock, by threads beyond STAT_SHARDS.
+  _Atomic(StatShard *) shards[STAT_SHARDS + 1];
+} Metric;
+
+Metric *metrics[MAX_METRICS];
+atomic_int n_metrics;
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER; // Registration
+pthread_mutex_t stat_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+atomic_int shard_busy[STAT_SHARDS];
+pthread_key_t shard_key; // Releases a thread's shard when it exits
+pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+_Thread_local int my_shard = -1;
+
+void shard_release(void *s) {
+  atomic_store(&shard_busy[(intptr_t)s - 1], 0);
+}
+
+void shard_key_init() { pthread_key_create(&shard_key, shard_release); }
+
+// The calling thread's shard, claimed on first use; -1 if none is free.
+int stat_shard() {
+  if (my_shard >= 0)
+    return my_shard;
+  pthread_once(&shard_once, shard_key_init);
+  for (int s = 0; s < STAT_SHARDS; s++) {
+    int idle = 0;
+    if (atomic_compare_exchange_strong(&shard_busy[s], &idle, 1)) {
+      pthread_setspecific(shard_key, (void *)(intptr_t)(s + 1));
+      return my_shard = s;
+    }
+  }
+  return -1;
+}
+
+// Parsed form of each interned text: 0 unknown, -2 being cached by one
+// thread, -1 not a reading, m + 1. type_value is written only by the
+// thread that moved its entry from 0 to -2.
+atomic_int type_metric[TYPE_OTHER + 1];
+double type_value[TYPE_OTHER + 1];
+
+// Bin from the exponent and top three mantissa bits; no libm needed.
+int stat_bin(double v) {
+  if (!(v > 0))
+    return 0;
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  int e = (int)(bits >> 52 & 0x7FF) - 1023 - STAT_MIN_EXP;
+  if (e < 0)
+    return 0;
+  int b = e * 8 + (int)(bits >> 49 & 7);
+  return b < STAT_BINS ? b : STAT_BINS - 1;
+}
+
+// Midpoint of bin b.
+double stat_bin_value(int b) {
+  uint64_t bits = (uint64_t)(b / 8 + STAT_MIN_EXP + 1023) << 52 |
+                  (uint64_t)(b % 8 * 2 + 1) << 48;
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+int find_metric(const char *name, const char *unit) {
+  int n = atomic_load(&n_metrics);
+  for (int m = 0; m < n; m++)
+    if (strcmp(metrics[m]->name, name) == 0)
+      return m;
+
+  pthread_mutex_lock(&metrics_lock);
+  int m = 0;
+  n = atomic_load(&n_metrics);
+  while (m < n && strcmp(metrics[m]->name, name) != 0)
+    m++;
+  if (m == n) {
+    Metric *mt = n < MAX_METRICS ? calloc(1, sizeof(Metric)) : NULL;
+    if (!mt) {
+      m = -1;
+    } else {
+      snprintf(mt->name, sizeof(mt->name), "%s", name);
+      snprintf(mt->unit, sizeof(mt->unit), "%s", unit);
+      metrics[n] = mt;
+      atomic_store(&n_metrics, n + 1);
+    }
+  }
+  pthread_mutex_unlock(&metrics_lock);
+  return m;
+}
+
+// Splits "Name: value unit"; returns the metric or -1 if msg is no reading.
+int parse_reading(const char *msg, double *value) {
+  const char *colon = strchr(msg, ':');
+  if (!colon || colon == msg || colon - msg >= 32)
+    return -1;
+  char *end;
+  *value = strtod(colon + 1, &end);
+  if (end == colon + 1)
+    return -1;
+
+  char name[32], unit[16];
+  memcpy(name, msg, colon - msg);
+  name[colon - msg] = '\0';
+  while (*end == ' ')
+    end++;
+  snprintf(unit, sizeof(unit), "%s", end);
+  return find_metric(name, unit);
+}
+
+void stats_add(int type, const char *msg, time_t when) {
+  double v;
+  int m;
+  if (type == TYPE_OTHER) {
+    m = parse_reading(msg, &v);
+  } else {
+    // Interned texts are parsed once; racing threads parse their own copy
+    int cached = atomic_load_explicit(&type_metric[type], memory_order_acquire);
+    if (cached == 0 || cached == -2) {
+      m = parse_reading(msg, &v);
+      if (cached == 0 &&
+          atomic_compare_exchange_strong(&type_metric[type], &cached, -2)) {
+        type_value[type] = v;
+        atomic_store_explicit(&type_metric[type], m >= 0 ? m + 1 : -1,
+                              memory_order_release);
+      }
+    } else {
+      m = cached - 1;
+      v = type_value[type];
+    }
+  }
+  if (m < 0)
     return;
 
-  Event *tmp = logg.head;
-  if (logg.cursor == tmp)
-    logg.cursor = tmp->next;
+  Metric *mt = metrics[m];
+  int s = stat_shard();
+  int shared = s < 0;
+  if (shared) {
+    s = STAT_SHARDS;
+    pthread_mutex_lock(&stat_shared_lock);
+  }
+  StatShard *sh = atomic_load_explicit(&mt->shards[s], memory_order_acquire);
+  if (!sh && (sh = calloc(1, sizeof(StatShard))))
+    atomic_store_explicit(&mt->shards[s], sh, memory_order_release);
+
+  if (sh) {
+    uint32_t sec = (uint32_t)when;
+    StatBucket *b = &sh->buckets[sec % STAT_SECONDS];
+    unsigned seq = atomic_load_explicit(&b->seq, memory_order_relaxed);
+    atomic_store_explicit(&b->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 
-  logg.head = tmp->next;
-  if (logg.head)
-    logg.head->prev = NULL;
-  else
-    logg.tail = NULL;
+    if (b->second != sec || b->count == 0) {
+      b->second = sec;
+      b->count = 0;
+      b->sum = 0;
+      b->min = b->max = v;
+      memset(b->hist, 0, sizeof(b->hist));
+    }
+    b->count++;
+    b->sum += v;
+    if (v < b->min)
+      b->min = v;
+    if (v > b->max)
+      b->max = v;
+    b->hist[stat_bin(v)]++;
 
-  free(tmp);
-  logg.count--;
+    atomic_store_explicit(&b->seq, seq + 2, memory_order_release);
+  }
+  if (shared)
+    pthread_mutex_unlock(&stat_shared_lock);
 }
 
-void add_event(const char *msg) {
-  pthread_mutex_lock(&logg.lock);
+// Copies a bucket its owner may be updating; a torn copy is retried.
+void stat_read(StatBucket *b, StatBucket *out) {
+  while (1) {
+    unsigned s1 = atomic_load_explicit(&b->seq, memory_order_acquire);
+    if (s1 & 1) {
+      sched_yield();
+      continue;
+    }
+    out->second = b->second;
+    out->count = b->count;
+    out->sum = b->sum;
+    out->min = b->min;
+    out->max = b->max;
+    memcpy(out->hist, b->hist, sizeof(out->hist));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&b->seq, memory_order_relaxed) == s1)
+      return;
+  }
+}
 
-  if (logg.count == MAX_EVENTS)
-    remove_oldest();
+// Prints count, min, mean, max and percentiles per metric and window.
+void cmd_stats() {
+  static const int windows[] = {10, 60, STAT_SECONDS};
+  uint32_t now = (uint32_t)time(NULL);
+  int n = atomic_load(&n_metrics);
+  if (n == 0) {
+    printf("No readings yet.\n");
+    return;
+  }
+
+  printf("%-16s %6s %8s %10s %10s %10s %10s %10s %10s\n", "metric", "window",
+         "count", "min", "mean", "max", "p50", "p90", "p99");
+  for (int m = 0; m < n; m++) {
+    Metric *mt = metrics[m];
+    char label[64];
+    snprintf(label, sizeof(label), "%s (%s)", mt->name, mt->unit);
+
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+      uint32_t hist[STAT_BINS];
+      uint64_t count = 0;
+      double sum = 0, lo = 0, hi = 0;
+      memset(hist, 0, sizeof(hist));
 
-  Event *e = malloc(sizeof(Event));
-  e->id = logg.next_id++;
-  timestamp(e->time);
-  strncpy(e->msg, msg, MSG_LEN);
-  e->prev = logg.tail;
-  e->next = NULL;
+      for (int s = 0; s <= STAT_SHARDS; s++) {
+        StatShard *sh = atomic_load_explicit(&mt->shards[s],
+                                             memory_order_acquire);
+        for (int k = 0; sh && k < windows[w]; k++) {
+          StatBucket b;
+          stat_read(&sh->buckets[(now - k) % STAT_SECONDS], &b);
+          if (b.count == 0 || b.second != now - k)
+            continue;
+          if (count == 0 || b.min < lo)
+            lo = b.min;
+          if (count == 0 || b.max > hi)
+            hi = b.max;
+          count += b.count;
+          sum += b.sum;
+          for (int i = 0; i < STAT_BINS; i++)
+            hist[i] += b.hist[i];
+        }
+      }
 
-  if (logg.tail)
-    logg.tail->next = e;
-  else
-    logg.head = e;
+      char win[16];
+      snprintf(win, sizeof(win), "%ds", windows[w]);
+      if (count == 0) {
+        printf("%-16s %6s %8d\n", w == 0 ? label : "", win, 0);
+        continue;
+      }
 
-  logg.tail = e;
-  logg.count++;
+      double pct[3] = {0.50, 0.90, 0.99}, at[3];
+      for (int p = 0; p < 3; p++) {
+        uint64_t target = (uint64_t)(pct[p] * count), seen = 0;
+        int i = 0;
+        while (i < STAT_BINS - 1 && (seen += hist[i]) <= target)
+          i++;
+        at[p] = stat_bin_value(i);
+        at[p] = at[p] < lo ? lo : at[p] > hi ? hi : at[p];
+      }
+      printf("%-16s %6s %8llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+             w == 0 ? label : "", win, (unsigned long long)count, lo,
+             sum / count, hi, at[0], at[1], at[2]);
+    }
+  }
+}
 
-  if (logg.count == 1)
-    logg.cursor = e; // Start at oldest
+// Fills slot n and its journal record; the caller has claimed n.
+void write_slot(uint64_t n, const char *msg, time_t when) {
+  journal_write(n, when, msg);
 
-  if (logg.live) {
-    printf("\n[LIVE] ");
-    print_event(e);
+  int type = intern(msg);
+  uint64_t off = 0;
+  size_t len = 0;
+  if (type == TYPE_OTHER) {
+    len = strnlen(msg, MSG_LEN - 1);
+    off = atomic_fetch_add(&logg.arena_head, len);
+    for (size_t k = 0; k < len; k++)
+      logg.arena[(off + k) & (logg.arena_size - 1)] = msg[k];
   }
 
-  pthread_mutex_unlock(&logg.lock);
+  uint64_t r = n - logg.origin;
+  Slot *e = &logg.ring[r % logg.ring_size];
+
+  // The slot is reused once per lap; wait for the previous writer only
+  uint64_t prev = r >= logg.ring_size ? 2 * (r - logg.ring_size) + 2 : 0;
+  while (atomic_load_explicit(&e->seq, memory_order_acquire) != prev)
+    sched_yield();
+
+  atomic_store_explicit(&e->seq, 2 * r + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  e->off = off;
+  e->when = (uint32_t)when;
+  e->type = (uint8_t)type;
+  e->len = (uint8_t)len;
+
+  atomic_store_explicit(&e->seq, 2 * r + 2, memory_order_release);
+  index_add(n, type, when);
+  stats_add(type, msg, when);
+}
+
+// Sizes the ring and its payload arena; both are allocated once.
+int ring_init(uint64_t slots) {
+  if (slots > SIZE_MAX / sizeof(Slot) / 2)
+    return 0;
+  logg.ring_size = slots;
+  logg.arena_size = 2 * MSG_LEN;
+  while (logg.arena_size < slots * ARENA_PER_EVENT)
+    logg.arena_size *= 2;
+  // Whole cache lines, as aligned_alloc() wants a multiple of the alignment
+  size_t bytes =
+      (slots * sizeof(Slot) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  logg.ring = aligned_alloc(CACHE_LINE, bytes);
+  logg.arena = malloc(logg.arena_size);
+  if (logg.ring)
+    memset(logg.ring, 0, bytes);
+  return logg.ring && logg.arena;
+}
+
+long peak_rss_kib() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+// Ring, index and journal together, next to what the process really holds.
+void report_memory() {
+  double mib = 1024.0 * 1024;
+  double bytes = (double)logg.ring_size * sizeof(Slot) + logg.arena_size;
+  double index = index_bytes();
+  double mapped = journal.hdr ? JOURNAL_HEADER +
+                                    (double)atomic_load(&journal.capacity) *
+                                        sizeof(JournalRecord)
+                              : 0;
+  printf("Ring: %llu events, %.1f bytes/event (%zu slot + %.1f arena), "
+         "%.1f MiB\n",
+         (unsigned long long)logg.ring_size, bytes / logg.ring_size,
+         sizeof(Slot), (double)logg.arena_size / logg.ring_size,
+         bytes / mib);
+  if (journal.hdr)
+    printf("Index: %.1f MiB, journal: %.1f MiB mapped\n", index / mib,
+           mapped / mib);
+  printf("Total: %.1f MiB, peak RSS %.1f MiB\n",
+         (bytes + index + mapped) / mib, peak_rss_kib() / 1024.0);
+}
+
+/*
+ * Live tail: a subscriber thread with its own cursor drains the log in
+ * batches and writes them with one large buffered write. Producers never
+ * wait for it; if it falls more than tail_max_lag events behind it skips
+ * ahead and reports how many events it dropped.
+ */
+uint64_t tail_max_lag = 10000; // -L
+
+void tail_flush(char *buf, size_t *len) {
+  if (*len == 0)
+    return;
+  fwrite(buf, 1, *len, stdout);
+  fflush(stdout);
+  *len = 0;
 }
 
+void *tail_thread(void *arg) {
+  (void)arg;
+  static char buf[TAIL_BUF];
+  size_t len = 0;
+  uint64_t cursor = 0, dropped = 0;
+  int following = 0;
+
+  while (atomic_load(&logg.running)) {
+    uint64_t head = atomic_load(logg.head);
+    if (!atomic_load(&logg.live)) {
+      following = 0;
+    } else if (!following) {
+      cursor = head; // Live starts from now
+      following = 1;
+    } else if (head - cursor > tail_max_lag) {
+      dropped += head - cursor;
+      cursor = head;
+    }
+
+    while (following && cursor < head) {
+      Event e;
+      if (!read_event(cursor, &e)) {
+        if (cursor >= oldest_seq())
+          break; // Still being written
+        dropped++; // Overwritten before we got to it
+        cursor++;
+        continue;
+      }
+      if (len + 64 + MSG_LEN > TAIL_BUF)
+        tail_flush(buf, &len);
+      len += snprintf(buf + len, TAIL_BUF - len, "\n[LIVE] [ID:%03d | %s] %s\n",
+                      e.id, e.time, e.msg);
+      cursor++;
+    }
+
+    if (dropped) {
+      len += snprintf(buf + len, TAIL_BUF - len,
+                      "\n[LIVE] lagging: %llu events dropped\n",
+                      (unsigned long long)dropped);
+      dropped = 0;
+    }
+    tail_flush(buf, &len);
+
+    struct timespec ts = {0, TAIL_POLL_NS};
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+void add_event(const char *msg) {
+  uint64_t n = atomic_fetch_add(logg.head, 1);
+  write_slot(n, msg, time(NULL));
+}
+
+/*
+ * Thread-local staging: events are collected per thread and published
+ * with a single sequence claim and a single timestamp per batch.
+ */
+typedef struct {
+  const char *msgs[MAX_BATCH];
+  int count;
+  int size; // Publish when this many are staged
+} Batch;
+
+void publish_batch(Batch *b) {
+  if (b->count == 0)
+    return;
+  time_t now = time(NULL);
+  uint64_t n = atomic_fetch_add(logg.head, (uint64_t)b->count);
+  for (int k = 0; k < b->count; k++)
+    write_slot(n + k, b->msgs[k], now);
+  b->count = 0;
+}
+
+void stage_event(Batch *b, const char *msg) {
+  b->msgs[b->count++] = msg;
+  if (b->count >= b->size)
+    publish_batch(b);
+}
+
+// Records torn by an earlier crash are skipped when browsing.
 void cmd_next() {
-  pthread_mutex_lock(&logg.lock);
-  if (logg.cursor && logg.cursor->next) {
-    logg.cursor = logg.cursor->next;
-    print_event(logg.cursor);
-  } else
-    printf("Already at newest.\n");
-  pthread_mutex_unlock(&logg.lock);
+  Event e;
+  uint64_t lo = oldest_seq();
+  if (logg.cursor < lo)
+    logg.cursor = lo; // Cursor's event was overwritten
+
+  uint64_t head = atomic_load(logg.head);
+  for (uint64_t n = logg.cursor + 1; n < head; n++) {
+    if (read_event(n, &e)) {
+      logg.cursor = n;
+      print_event(&e);
+      return;
+    }
+    if (n >= logg.origin)
+      break; // Still being written
+  }
+  printf("Already at newest.\n");
 }
 
 void cmd_prev() {
-  pthread_mutex_lock(&logg.lock);
-  if (logg.cursor && logg.cursor->prev) {
-    logg.cursor = logg.cursor->prev;
-    print_event(logg.cursor);
-  } else
-    printf("Already at oldest.\n");
-  pthread_mutex_unlock(&logg.lock);
+  Event e;
+  uint64_t lo = oldest_seq();
+  if (logg.cursor < lo)
+    logg.cursor = lo;
+
+  for (uint64_t n = logg.cursor; n > lo; n--) {
+    if (read_event(n - 1, &e)) {
+      logg.cursor = n - 1;
+      print_event(&e);
+      return;
+    }
+  }
+  printf("Already at oldest.\n");
 }
 
 void cmd_clear() {
-  pthread_mutex_lock(&logg.lock);
-  Event *cur = logg.head;
-  while (cur) {
-    Event *n = cur->next;
-    free(cur);
-    cur = n;
-  }
-  logg.head = logg.tail = logg.cursor = NULL;
-  logg.count = 0;
+  uint64_t head = atomic_load(logg.head);
+  atomic_store(&logg.base, head);
+  logg.cursor = head;
   printf("All events cleared.\n");
-  pthread_mutex_unlock(&logg.lock);
 }
 
+int event_count() { return (int)(atomic_load(logg.head) - oldest_seq()); }
+
 void cmd_exit() {
-  pthread_mutex_lock(&logg.lock);
-  logg.running = 0;
-  printf("\nShutting down. Events stored: %d\n", logg.count);
-  pthread_mutex_unlock(&logg.lock);
+  atomic_store(&logg.running, 0);
+  printf("\nShutting down. Events stored: %d\n", event_count());
 }
 
+const char *meter_msgs[] = {"Power: 3.4 kW", "Voltage: 230 V",
+                            "Frequency: 50 Hz", "Fault: Overcurrent"};
+
+int batch_size = 1; // Events staged per publish (-b)
+
 void *producer(void *arg) {
-  const char *msgs[] = {"Power: 3.4 kW", "Voltage: 230 V", "Frequency: 50 Hz",
-                        "Fault: Overcurrent"};
-  int i = 0;
+  int i = (int)(intptr_t)arg; // Stagger meters so messages interleave
+  Batch b = {.count = 0, .size = batch_size};
 
-  while (logg.running) {
-    add_event(msgs[i % 4]);
+  while (atomic_load(&logg.running)) {
+    stage_event(&b, meter_msgs[i % 4]);
     i++;
     sleep(2);
   }
+  publish_batch(&b);
+  return NULL;
+}
+
+/*
+ * Load generator: for 1, 2, 4, ... threads, every thread stages events as
+ * fast as it can for a fixed time. Each stage_event() call is timed, so
+ * the latency includes the publishes it triggers.
+ */
+typedef struct {
+  int index;
+  double seconds;
+  uint64_t events;
+  uint32_t lat[LAT_BUCKETS + 1]; // Last bucket collects the overflow
+} LoadWorker;
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *load_worker(void *arg) {
+  LoadWorker *w = arg;
+  Batch b = {.count = 0, .size = batch_size};
+  double end = now_sec() + w->seconds;
+  uint64_t i = w->index;
+
+  while (1) {
+    for (int k = 0; k < 1024; k++) {
+      uint64_t t0 = now_ns();
+      stage_event(&b, meter_msgs[i++ % 4]);
+      uint64_t bucket = (now_ns() - t0) / LAT_NS_PER_BUCKET;
+      w->lat[bucket < LAT_BUCKETS ? bucket : LAT_BUCKETS]++;
+    }
+    w->events += 1024;
+    if (now_sec() >= end)
+      break;
+  }
+  publish_batch(&b);
   return NULL;
 }
 
-int main() {
+void run_load(int max_threads, double seconds) {
+  static LoadWorker workers[MAX_PRODUCERS];
+  pthread_t tids[MAX_PRODUCERS];
+
+  printf("Load test: %.1f s per step, batch %d\n", seconds, batch_size);
+  report_memory();
+  printf("%8s %14s %14s\n", "threads", "events/sec", "p99 enqueue");
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    memset(workers, 0, sizeof(workers));
+    double t0 = now_sec();
+    for (int t = 0; t < threads; t++) {
+      workers[t].index = t;
+      workers[t].seconds = seconds;
+      pthread_create(&tids[t], NULL, load_worker, &workers[t]);
+    }
+
+    uint64_t events = 0;
+    uint64_t lat[LAT_BUCKETS + 1] = {0};
+    for (int t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      events += workers[t].events;
+      for (int k = 0; k <= LAT_BUCKETS; k++)
+        lat[k] += workers[t].lat[k];
+    }
+    double secs = now_sec() - t0;
+
+    uint64_t target = events - events / 100, seen = 0;
+    int k = 0;
+    for (; k < LAT_BUCKETS; k++) {
+      seen += lat[k];
+      if (seen >= target)
+        break;
+    }
+
+    char p99[32];
+    if (k == LAT_BUCKETS)
+      snprintf(p99, sizeof(p99), ">%d ns", LAT_BUCKETS * LAT_NS_PER_BUCKET);
+    else
+      snprintf(p99, sizeof(p99), "%d ns", (k + 1) * LAT_NS_PER_BUCKET);
+    printf("%8d %14.0f %14s\n", threads, events / secs, p99);
+
+    if (threads < max_threads && threads * 2 > max_threads)
+      threads = max_threads / 2; // Always finish on max_threads
+  }
+  report_memory();
+}
+
+// Accepts YYYY-MM-DDTHH:MM[:SS] or HH:MM[:SS] (today), local time.
+int parse_when(const char *s, time_t *out) {
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  tm.tm_sec = 0;
+  int got;
+  if (strchr(s, 'T')) {
+    got = sscanf(s, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                 &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (got < 5)
+      return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+  } else if (sscanf(s, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 2)
+    return 0;
+  tm.tm_isdst = -1;
+  *out = mktime(&tm);
+  return *out != (time_t)-1;
+}
+
+/*
+ * q [^prefix | substring] [id=A-B] [after=T] [before=T]
+ * Words that are not filters form the message text.
+ */
+void cmd_query(char *args) {
+  char text[MSG_LEN] = "";
+  uint64_t id_lo = 0, id_hi = UINT64_MAX;
+  time_t after = 0, before = (time_t)UINT32_MAX;
+  char *save = NULL;
+
+  for (char *w = strtok_r(args, " \t\n", &save); w;
+       w = strtok_r(NULL, " \t\n", &save)) {
+    unsigned long long a, b;
+    if (sscanf(w, "id=%llu-%llu", &a, &b) == 2) {
+      id_lo = a;
+      id_hi = b;
+    } else if (strncmp(w, "after=", 6) == 0) {
+      if (!parse_when(w + 6, &after)) {
+        printf("Bad time: %s\n", w + 6);
+        return;
+      }
+    } else if (strncmp(w, "before=", 7) == 0) {
+      if (!parse_when(w + 7, &before)) {
+        printf("Bad time: %s\n", w + 7);
+        return;
+      }
+    } else {
+      if (text[0])
+        strncat(text, " ", sizeof(text) - strlen(text) - 1);
+      strncat(text, w, sizeof(text) - strlen(text) - 1);
+    }
+  }
+
+  double t0 = now_sec();
+  uint64_t lo = oldest_seq(), hi = atomic_load(logg.head);
+  if (lo < id_lo)
+    lo = id_lo;
+  if (id_hi < hi)
+    hi = id_hi + 1;
+  uint64_t history = atomic_load(&idx.history);
+
+  // Resolve the text filter against the interned texts once
+  int prefix = text[0] == '^';
+  const char *needle = text + prefix;
+  uint64_t mask[4] = {0};
+  for (int t = 1; t <= MAX_TYPES; t++) {
+    char *name = atomic_load(&idx.names[t - 1]);
+    if (name && (prefix ? strncmp(name, needle, strlen(needle)) == 0
+                        : strstr(name, needle) != NULL))
+      mask[t / 64] |= 1ULL << (t % 64);
+  }
+  mask[TYPE_OTHER / 64] |= 1ULL << (TYPE_OTHER % 64); // Checked by text
+
+  uint64_t matches = 0, blocks = 0;
+  for (uint64_t blk = lo / INDEX_BLOCK; lo < hi && blk <= (hi - 1) / INDEX_BLOCK;
+       blk++) {
+    // Only journaled sequences have a block summary to skip by
+    if (idx.type && blk < JOURNAL_MAX / INDEX_BLOCK) {
+      IndexBlock *b = &idx.blocks[blk];
+      int any = 0;
+      for (int k = 0; k < 4; k++)
+        any |= (atomic_load_explicit(&b->types[k], memory_order_relaxed) &
+                mask[k]) != 0;
+      uint32_t t_min = atomic_load(&b->t_min), t_max = atomic_load(&b->t_max);
+      if (!any || t_max < (uint64_t)after || t_min > (uint64_t)before)
+        continue;
+    }
+    blocks++;
+
+    uint64_t first = blk * INDEX_BLOCK > lo ? blk * INDEX_BLOCK : lo;
+    uint64_t last = (blk + 1) * INDEX_BLOCK < hi ? (blk + 1) * INDEX_BLOCK : hi;
+    for (uint64_t n = first; n < last; n++) {
+      int t;
+      uint32_t secs;
+      if (!event_meta(n, &t, &secs) || !(mask[t / 64] >> (t % 64) & 1))
+        continue;
+      if (secs < (uint64_t)after || secs > (uint64_t)before)
+        continue;
+
+      Event e;
+      int have = 0;
+      if (t == TYPE_OTHER) {
+        if (!(have = read_event(n, &e)))
+          continue;
+        if (prefix ? strncmp(e.msg, needle, strlen(needle)) != 0
+                   : strstr(e.msg, needle) == NULL)
+          continue;
+      }
+      if (matches < QUERY_SHOW && (have || read_event(n, &e)))
+        print_event(&e);
+      matches++;
+    }
+  }
+
+  printf("%llu matches in [%llu, %llu), %llu blocks scanned, %.2f ms\n",
+         (unsigned long long)matches, (unsigned long long)lo,
+         (unsigned long long)(hi > lo ? hi : lo), (unsigned long long)blocks,
+         (now_sec() - t0) * 1e3);
+  if (matches > QUERY_SHOW)
+    printf("(first %d shown)\n", QUERY_SHOW);
+  if (lo < logg.origin && history < logg.origin)
+    printf("(earlier runs still being indexed: %llu of %llu events so far)\n",
+           (unsigned long long)history, (unsigned long long)logg.origin);
+}
+
+int main(int argc, char *argv[]) {
+  int producers = 1;
+  int load_threads = 0;
+  double load_seconds = 1.0;
+  const char *journal_path = NULL;
+  int use_journal = 1;
+  long long ring_slots = MAX_EVENTS;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      producers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      batch_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+      load_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      load_seconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc)
+      journal_path = argv[++i];
+    else if (strcmp(argv[i], "--no-journal") == 0)
+      use_journal = 0;
+    else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+      tail_max_lag = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      ring_slots = atoll(argv[++i]);
+    else {
+      printf("Usage: %s [-n ring] [-p producers] [-b batch] [-L max_lag] "
+             "[-J journal | --no-journal]\n",
+             argv[0]);
+      printf("       %s --load max_threads [-t seconds] [-n ring] [-b batch] "
+             "[-J journal]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+  if (producers < 1)
+    producers = 1;
+  if (producers > MAX_PRODUCERS)
+    producers = MAX_PRODUCERS;
+  if (batch_size < 1)
+    batch_size = 1;
+  if (batch_size > MAX_BATCH)
+    batch_size = MAX_BATCH;
+  if (ring_slots < 1)
+    ring_slots = 1;
 
   memset(&logg, 0, sizeof(logg));
-  pthread_mutex_init(&logg.lock, NULL);
-  logg.running = 1;
+  logg.head = &logg.head_mem;
+  if (!ring_init((uint64_t)ring_slots)) {
+    printf("Cannot allocate a ring of %lld events\n", ring_slots);
+    return 1;
+  }
+  atomic_store(&logg.running, 1);
+
+  // Load tests only journal when asked to, so they measure the ring alone
+  if (!journal_path && load_threads == 0)
+    journal_path = JOURNAL_PATH;
+  if (use_journal && journal_path && journal_open(journal_path)) {
+    logg.head = &journal.hdr->next;
+    logg.origin = atomic_load(logg.head);
+    logg.cursor = logg.origin;
+    index_init();
+    if (load_threads == 0)
+      printf("Journal %s: %llu earlier events\n", journal_path,
+             (unsigned long long)logg.origin);
+  }
+  if (load_threads == 0)
+    report_memory();
+
+  if (load_threads > 0) {
+    run_load(load_threads > MAX_PRODUCERS ? MAX_PRODUCERS : load_threads,
+             load_seconds);
+    journal_close();
+    return 0;
+  }
 
   /* Initial events */
   add_event("System Boot");
   add_event("Meter Connected");
 
-  pthread_t tid;
-  pthread_create(&tid, NULL, producer, NULL);
+  pthread_t tids[MAX_PRODUCERS], tail, history;
+  for (int t = 0; t < producers; t++)
+    pthread_create(&tids[t], NULL, producer, (void *)(intptr_t)t);
+  pthread_create(&tail, NULL, tail_thread, NULL);
+  int indexing = logg.origin > 0 && idx.type &&
+                 pthread_create(&history, NULL, history_thread, NULL) == 0;
 
   printf(" Smart Energy Gateway \n");
-  printf("n=next  p=prev  r=live  h=hold  c=clear  x=exit\n\n");
+  printf("n=next  p=prev  r=live  h=hold  c=clear  a=stats  x=exit\n");
+  printf("q [^prefix|text] [id=A-B] [after=T] [before=T]  query\n\n");
 
-  print_event(logg.cursor); // Start at oldest
+  Event first;
+  print_event(read_event(logg.cursor, &first) ? &first : NULL); // This boot
 
   char cmd;
-  while (logg.running) {
+  while (atomic_load(&logg.running)) {
     printf("\n> ");
     scanf(" %c", &cmd);
 
@@ -177,16 +1305,25 @@ int main() {
       cmd_prev();
       break;
     case 'r':
-      logg.live = 1;
+      atomic_store(&logg.live, 1);
       printf("Live ON\n");
       break;
     case 'h':
-      logg.live = 0;
+      atomic_store(&logg.live, 0);
       printf("Live paused\n");
       break;
     case 'c':
       cmd_clear();
       break;
+    case 'a':
+      cmd_stats();
+      break;
+    case 'q': {
+      char line[256];
+      if (fgets(line, sizeof(line), stdin))
+        cmd_query(line);
+      break;
+    }
     case 'x':
       cmd_exit();
       break;
@@ -195,8 +1332,11 @@ int main() {
     }
   }
 
-  pthread_join(tid, NULL);
-  cmd_clear();
-  pthread_mutex_destroy(&logg.lock);
+  for (int t = 0; t < producers; t++)
+    pthread_join(tids[t], NULL);
+  pthread_join(tail, NULL);
+  if (indexing)
+    pthread_join(history, NULL);
+  journal_close();
   return 0;
 }
@@ -1,46 +1,422 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
 
 #define MAX_LEN 64
 #define REVIEW_FILE "rejected_commands.log"
+#define COMMAND_FILE "commands.txt"
 #define THRESHOLD 3
+#define BT_MIN 16 // B-tree minimum degree: nodes hold 15..31 keys
+#define BT_MAX (2 * BT_MIN - 1)
+#define PREFIX_SHOW 20 // Completions printed per prefix query
+#define INDEX_MAGIC "CMX3"
+#define INDEX_ALIGN 64 // Section alignment in the index file
+#define AUDIT_QUEUE 4096      // Default audit queue capacity, in entries
+#define AUDIT_BUF (64 * 1024) // Audit writes are at most this large
+#define SERVE_SOCKET "authorizer.sock"
+#define MAX_WORKERS 64
+#define MAX_CONNS 4096      // Highest connection descriptor served
+#define SERVE_BUF 4096      // Per-connection read and reply buffers
+#define RELOAD_POLL_MS 1000 // How often the server checks commands.txt
+#define LOAD_LAT_US 100000  // Load generator latency histogram range
 
-typedef struct Node {
-  char cmd[MAX_LEN];
-  struct Node *left, *right;
-} Node;
+/*
+ * B-tree ordered index. Nodes pack up to BT_MAX keys as pool offsets plus
+ * their first eight bytes as a big-endian integer, so most comparisons
+ * inside a node are integer compares on one or two cache lines. Nodes
+ * live in one array and refer to each other by index.
+ */
+typedef struct {
+  int32_t n, leaf;
+  uint64_t prefix[BT_MAX]; // First 8 bytes of each key
+  uint32_t key[BT_MAX];    // Offsets into the string pool
+  uint32_t child[BT_MAX + 1];
+} BTNode;
+
+typedef struct {
+  BTNode *nodes;
+  uint32_t n_nodes, cap, root, count;
+} BTree;
 
-Node *new_node(const char *cmd) {
-  Node *n = malloc(sizeof(Node));
-  strcpy(n->cmd, cmd);
-  n->left = n->right = NULL;
-  return n;
+uint64_t key_prefix(const char *s) {
+  uint64_t p = 0;
+  int i = 0;
+  for (; i < 8 && s[i]; i++)
+    p = p << 8 | (unsigned char)s[i];
+  return p << (8 * (8 - i));
 }
 
-Node *insert(Node *root, const char *cmd) {
-  if (!root)
-    return new_node(cmd);
-  int cmp = strcmp(cmd, root->cmd);
-  if (cmp < 0)
-    root->left = insert(root->left, cmd);
-  else if (cmp > 0)
-    root->right = insert(root->right, cmd);
-  return root;
+int bt_cmp(const char *pool, const BTNode *x, int i, const char *cmd,
+           uint64_t pfx) {
+  if (pfx != x->prefix[i])
+    return pfx < x->prefix[i] ? -1 : 1;
+  return strcmp(cmd, pool + x->key[i]);
 }
 
-int search(Node *root, const char *cmd) {
-  if (!root)
+int bt_search(const BTree *t, const char *pool, const char *cmd) {
+  if (!t->n_nodes)
     return 0;
-  int cmp = strcmp(cmd, root->cmd);
-  if (cmp == 0)
-    return 1;
-  return (cmp < 0) ? search(root->left, cmd) : search(root->right, cmd);
+  uint64_t pfx = key_prefix(cmd);
+  for (const BTNode *x = &t->nodes[t->root];;) {
+    int i = 0, c = 1;
+    while (i < x->n && (c = bt_cmp(pool, x, i, cmd, pfx)) > 0)
+      i++;
+    if (i < x->n && c == 0)
+      return 1;
+    if (x->leaf)
+      return 0;
+    x = &t->nodes[x->child[i]];
+  }
 }
 
-int edit_distance(const char *a, const char *b) {
+// May move the node array; callers re-derive node pointers afterwards.
+uint32_t bt_node(BTree *t, int leaf) {
+  if (t->n_nodes == t->cap) {
+    t->cap = t->cap ? t->cap * 2 : 16;
+    t->nodes = realloc(t->nodes, t->cap * sizeof(BTNode));
+  }
+  BTNode *x = &t->nodes[t->n_nodes];
+  memset(x, 0, sizeof(*x));
+  x->leaf = leaf;
+  return t->n_nodes++;
+}
+
+// Moves the median of full child i up into node xi.
+void bt_split(BTree *t, uint32_t xi, int i) {
+  uint32_t zi = bt_node(t, 0);
+  BTNode *x = &t->nodes[xi], *y = &t->nodes[x->child[i]], *z = &t->nodes[zi];
+  z->leaf = y->leaf;
+  z->n = BT_MIN - 1;
+  memcpy(z->prefix, y->prefix + BT_MIN, z->n * sizeof(uint64_t));
+  memcpy(z->key, y->key + BT_MIN, z->n * sizeof(uint32_t));
+  if (!y->leaf)
+    memcpy(z->child, y->child + BT_MIN, BT_MIN * sizeof(uint32_t));
+  y->n = BT_MIN - 1;
+
+  memmove(x->child + i + 2, x->child + i + 1, (x->n - i) * sizeof(uint32_t));
+  memmove(x->prefix + i + 1, x->prefix + i, (x->n - i) * sizeof(uint64_t));
+  memmove(x->key + i + 1, x->key + i, (x->n - i) * sizeof(uint32_t));
+  x->child[i + 1] = zi;
+  x->prefix[i] = y->prefix[BT_MIN - 1];
+  x->key[i] = y->key[BT_MIN - 1];
+  x->n++;
+}
+
+// Inserts the key at pool offset off, which must not be present yet.
+void bt_insert(BTree *t, const char *pool, uint32_t off) {
+  const char *cmd = pool + off;
+  t->count++;
+  if (!t->n_nodes)
+    t->root = bt_node(t, 1);
+  if (t->nodes[t->root].n == BT_MAX) {
+    uint32_t r = bt_node(t, 0);
+    t->nodes[r].child[0] = t->root;
+    t->root = r;
+    bt_split(t, r, 0);
+  }
+
+  // Split full nodes on the way down so the leaf always has room
+  uint64_t pfx = key_prefix(cmd);
+  uint32_t xi = t->root;
+  while (1) {
+    BTNode *x = &t->nodes[xi];
+    int i = 0;
+    while (i < x->n && bt_cmp(pool, x, i, cmd, pfx) > 0)
+      i++;
+    if (x->leaf) {
+      memmove(x->prefix + i + 1, x->prefix + i, (x->n - i) * sizeof(uint64_t));
+      memmove(x->key + i + 1, x->key + i, (x->n - i) * sizeof(uint32_t));
+      x->prefix[i] = pfx;
+      x->key[i] = off;
+      x->n++;
+      return;
+    }
+    if (t->nodes[x->child[i]].n == BT_MAX) {
+      bt_split(t, xi, i);
+      x = &t->nodes[xi];
+      if (bt_cmp(pool, x, i, cmd, pfx) > 0)
+        i++;
+    }
+    xi = x->child[i];
+  }
+}
+
+/*
+ * Bottom-up build from n sorted keys in one pass per level: each level is
+ * cut into the fewest nodes of at most BT_MAX keys, and the key between
+ * two neighbours moves up as their separator.
+ */
+void bt_build(BTree *t, const char *pool, const uint32_t *sorted, uint32_t n) {
+  if (n == 0)
+    return;
+  uint32_t m = n, *keys = malloc(n * sizeof(uint32_t)), *kids = NULL;
+  memcpy(keys, sorted, n * sizeof(uint32_t));
+  t->count = n;
+
+  while (1) {
+    uint32_t groups = (m + 1 + BT_MAX) / (BT_MAX + 1);
+    uint32_t per = (m - (groups - 1)) / groups;
+    uint32_t extra = (m - (groups - 1)) % groups;
+    uint32_t *up_keys = malloc(groups * sizeof(uint32_t));
+    uint32_t *up_kids = malloc(groups * sizeof(uint32_t));
+    uint32_t pos = 0, cpos = 0;
+
+    for (uint32_t g = 0; g < groups; g++) {
+      uint32_t k = per + (g < extra), xi = bt_node(t, kids == NULL);
+      BTNode *x = &t->nodes[xi];
+      x->n = k;
+      for (uint32_t i = 0; i < k; i++) {
+        x->key[i] = keys[pos + i];
+        x->prefix[i] = key_prefix(pool + keys[pos + i]);
+      }
+      if (kids)
+        memcpy(x->child, kids + cpos, (k + 1) * sizeof(uint32_t));
+      pos += k;
+      cpos += k + 1;
+      up_kids[g] = xi;
+      if (g + 1 < groups)
+        up_keys[g] = keys[pos++];
+    }
+
+    free(keys);
+    free(kids);
+    keys = up_keys;
+    kids = up_kids;
+    m = groups - 1;
+    if (groups == 1) {
+      t->root = kids[0];
+      break;
+    }
+  }
+  free(keys);
+  free(kids);
+}
+
+int bt_depth(const BTree *t) {
+  if (!t->n_nodes)
+    return 0;
+  int d = 1;
+  for (const BTNode *x = &t->nodes[t->root]; !x->leaf;
+       x = &t->nodes[x->child[0]])
+    d++;
+  return d;
+}
+
+/*
+ * Lists keys starting with prefix in order: the first `limit` are printed,
+ * all are counted. Returns 1 once past the prefix range.
+ */
+int bt_prefix(const BTree *t, const char *pool, uint32_t xi,
+              const char *prefix, size_t len, int limit, long *total) {
+  const BTNode *x = &t->nodes[xi];
+  for (int i = 0; i < x->n; i++) {
+    const char *key = pool + x->key[i];
+    int c = strncmp(key, prefix, len);
+    if (c < 0)
+      continue; // This key and its left subtree sort before the range
+    if (!x->leaf &&
+        bt_prefix(t, pool, x->child[i], prefix, len, limit, total))
+      return 1;
+    if (c > 0)
+      return 1;
+    if ((*total)++ < limit)
+      printf("  %s\n", key);
+  }
+  return !x->leaf &&
+         bt_prefix(t, pool, x->child[x->n], prefix, len, limit, total);
+}
+
+/*
+ * Flat open-addressing set for exact authorization. A slot is the top
+ * half of the key's hash plus the key's offset in the string pool, so a
+ * probe reads one 8-byte slot and compares strings only when the hash
+ * matches.
+ */
+typedef struct {
+  uint32_t tag; // High 32 bits of the hash
+  uint32_t key; // Pool offset + 1; 0 = empty
+} Slot;
+
+/*
+ * Optional minimal perfect hash over the same keys (hash and displace):
+ * keys are split into buckets, and each bucket gets the first seed that
+ * sends all its keys to free slots. One bucket read and one key compare
+ * per lookup, with exactly one slot per key.
+ */
+typedef struct {
+  uint32_t *seed; // Per bucket
+  uint32_t *keys; // Pool offset of the key in each slot
+  uint32_t n, n_buckets;
+} PerfectHash;
+
+typedef struct {
+  Slot *slots;
+  uint32_t mask, count;
+  PerfectHash perfect; // Used for lookups once built
+} CommandSet;
+
+uint64_t hash_str(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return h;
+}
+
+uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ h >> 33;
+}
+
+uint32_t perfect_slot(const PerfectHash *ph, uint64_t h) {
+  uint32_t b = (uint32_t)h % ph->n_buckets;
+  return mix64(h ^ ph->seed[b] * 0x9E3779B97F4A7C15ULL) % ph->n;
+}
+
+int set_contains(const CommandSet *s, const char *pool, const char *cmd) {
+  uint64_t h = hash_str(cmd);
+  if (s->perfect.n)
+    return strcmp(pool + s->perfect.keys[perfect_slot(&s->perfect, h)],
+                  cmd) == 0;
+  if (!s->slots)
+    return 0;
+
+  uint32_t tag = h >> 32;
+  for (uint32_t i = (uint32_t)h & s->mask;; i = (i + 1) & s->mask) {
+    Slot sl = s->slots[i];
+    if (!sl.key)
+      return 0;
+    if (sl.tag == tag && strcmp(pool + sl.key - 1, cmd) == 0)
+      return 1;
+  }
+}
+
+void set_place(CommandSet *s, uint64_t h, uint32_t key) {
+  uint32_t i = (uint32_t)h & s->mask;
+  while (s->slots[i].key)
+    i = (i + 1) & s->mask;
+  s->slots[i].tag = h >> 32;
+  s->slots[i].key = key;
+}
+
+// Sizes the table for n keys at a load factor of at most 1/2.
+void set_resize(CommandSet *s, const char *pool, uint32_t n) {
+  uint32_t size = 16;
+  while (size < 2 * n)
+    size *= 2;
+  Slot *old = s->slots;
+  uint32_t old_size = old ? s->mask + 1 : 0;
+  s->slots = calloc(size, sizeof(Slot));
+  s->mask = size - 1;
+  for (uint32_t i = 0; i < old_size; i++)
+    if (old[i].key)
+      set_place(s, hash_str(pool + old[i].key - 1), old[i].key);
+  free(old);
+}
+
+// Adds the key at pool offset off, which must not be present yet.
+void set_insert(CommandSet *s, const char *pool, uint32_t off) {
+  if (!s->slots || (s->count + 1) * 2 > s->mask + 1)
+    set_resize(s, pool, (s->mask + 1) / 2 + 1);
+  set_place(s, hash_str(pool + off), off + 1);
+  s->count++;
+}
+
+// Builds the perfect hash for a static whitelist; returns 0 on failure.
+int perfect_build(CommandSet *s, const char *pool) {
+  uint32_t n = s->count;
+  if (n == 0)
+    return 0;
+  PerfectHash ph = {.n = n, .n_buckets = n / 4 + 1};
+  ph.seed = calloc(ph.n_buckets, sizeof(uint32_t));
+  ph.keys = malloc(n * sizeof(uint32_t));
+  uint64_t *hashes = malloc(n * sizeof(uint64_t));
+  uint32_t *offs = malloc(n * sizeof(uint32_t));
+  uint32_t *start = calloc(ph.n_buckets + 2, sizeof(uint32_t));
+  uint32_t *items = malloc(n * sizeof(uint32_t));
+  uint8_t *taken = calloc(n, 1);
+  uint32_t pos[64];
+
+  // Keys grouped by bucket
+  uint32_t k = 0, max_size = 0;
+  for (uint32_t i = 0; i <= s->mask; i++)
+    if (s->slots[i].key) {
+      offs[k] = s->slots[i].key - 1;
+      hashes[k] = hash_str(pool + offs[k]);
+      start[(uint32_t)hashes[k] % ph.n_buckets + 2]++;
+      k++;
+    }
+  for (uint32_t b = 0; b < ph.n_buckets; b++) {
+    if (start[b + 2] > max_size)
+      max_size = start[b + 2];
+    start[b + 2] += start[b + 1];
+  }
+  for (k = 0; k < n; k++)
+    items[start[(uint32_t)hashes[k] % ph.n_buckets + 1]++] = k;
+
+  // Largest buckets first, while most slots are still free
+  int ok = max_size <= 64;
+  for (uint32_t size = max_size; ok && size > 0; size--)
+    for (uint32_t b = 0; ok && b < ph.n_buckets; b++) {
+      uint32_t first = b ? start[b] : 0, count = start[b + 1] - first;
+      if (count != size)
+        continue;
+      for (uint32_t seed = 1;; seed++) {
+        if (seed > 100000000) {
+          ok = 0;
+          break;
+        }
+        ph.seed[b] = seed;
+        uint32_t j = 0;
+        for (; j < count; j++) {
+          pos[j] = perfect_slot(&ph, hashes[items[first + j]]);
+          if (taken[pos[j]])
+            break;
+          taken[pos[j]] = 1;
+        }
+        if (j == count)
+          break;
+        while (j-- > 0)
+          taken[pos[j]] = 0;
+      }
+      for (uint32_t j = 0; ok && j < count; j++)
+        ph.keys[pos[j]] = offs[items[first + j]];
+    }
+
+  free(hashes);
+  free(offs);
+  free(start);
+  free(items);
+  free(taken);
+  if (!ok) {
+    free(ph.seed);
+    free(ph.keys);
+    return 0;
+  }
+  s->perfect = ph;
+  return 1;
+}
+
+// Reference kernel: full DP table. Used by the benchmark to check Myers.
+int edit_distance_dp(const char *a, const char *b) {
   int la = strlen(a), lb = strlen(b);
   int dp[65][65];
 
@@ -64,60 +440,1726 @@ int edit_distance(const char *a, const char *b) {
   return dp[la][lb];
 }
 
-void find_closest(Node *root, const char *input, char *best, int *best_dist) {
-  if (!root)
+/*
+ * Myers' bit-parallel edit distance: bit i of the vertical delta vectors
+ * describes row i of a DP column, so each character of the text costs a
+ * handful of word operations. Commands are shorter than 64 bytes, so the
+ * pattern always fits in one word.
+ */
+typedef struct {
+  uint64_t peq[256]; // Bit i set where pattern[i] == c
+  int len;
+} Pattern;
+
+void pattern_init(Pattern *p, const char *s) {
+  memset(p->peq, 0, sizeof(p->peq));
+  p->len = strlen(s);
+  for (int i = 0; i < p->len; i++)
+    p->peq[(unsigned char)s[i]] |= 1ULL << i;
+}
+
+/*
+ * Distance between the pattern and text, or bound + 1 as soon as it
+ * provably exceeds bound: the last row can drop by at most one per
+ * remaining text character.
+ */
+int edit_distance_bounded(const Pattern *p, const char *text, int bound) {
+  int n = strlen(text), m = p->len;
+  if (abs(n - m) > bound)
+    return bound + 1;
+  if (m == 0)
+    return n;
+
+  uint64_t pv = ~0ULL, mv = 0, last = 1ULL << (m - 1);
+  int score = m;
+  for (int j = 0; j < n; j++) {
+    uint64_t eq = p->peq[(unsigned char)text[j]];
+    uint64_t xv = eq | mv;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    if (ph & last)
+      score++;
+    else if (mh & last)
+      score--;
+    if (score - (n - j - 1) > bound)
+      return bound + 1;
+    ph = ph << 1 | 1; // Row 0 grows by one per column
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
+int edit_distance(const char *a, const char *b) {
+  Pattern p;
+  pattern_init(&p, a);
+  return edit_distance_bounded(&p, b, MAX_LEN);
+}
+
+// In key order. Only a strictly closer command matters, so the kernel
+// stops at best - 1.
+void find_closest(const BTree *t, const char *pool, uint32_t xi,
+                  const Pattern *input, char *best, int *best_dist) {
+  const BTNode *x = &t->nodes[xi];
+  for (int i = 0; i <= x->n; i++) {
+    if (!x->leaf)
+      find_closest(t, pool, x->child[i], input, best, best_dist);
+    if (i == x->n)
+      break;
+
+    const char *key = pool + x->key[i];
+    int bound = *best_dist > MAX_LEN ? MAX_LEN : *best_dist - 1;
+    int d = edit_distance_bounded(input, key, bound);
+    if (d < *best_dist) {
+      *best_dist = d;
+      strcpy(best, key);
+    }
+  }
+}
+
+/*
+ * BK-tree over the whitelist: a child hangs off its parent at their edit
+ * distance, so by the triangle inequality a query at distance d from a
+ * node only needs the children whose key is within best_dist of d. Node 0
+ * is the root, so index 0 also means "no node" in child and next.
+ */
+typedef struct {
+  uint32_t key;              // Pool offset
+  uint16_t dist;             // Distance to the parent
+  uint16_t max_child;        // Largest child distance
+  uint32_t child, next;      // First child, next sibling
+} BKNode;
+
+typedef struct {
+  BKNode *nodes;
+  uint32_t n, cap;
+} BKTree;
+
+// Nodes scored by bk_closest(), for the benchmark; per thread for the server
+_Thread_local long bk_visited;
+
+void bk_insert(BKTree *bk, const char *pool, uint32_t off) {
+  if (bk->n == bk->cap) {
+    bk->cap = bk->cap ? bk->cap * 2 : 16;
+    bk->nodes = realloc(bk->nodes, bk->cap * sizeof(BKNode));
+  }
+  BKNode n = {.key = off};
+  if (bk->n == 0) {
+    bk->nodes[bk->n++] = n;
     return;
+  }
 
-  find_closest(root->left, input, best, best_dist);
+  const char *cmd = pool + off;
+  uint32_t cur = 0;
+  while (1) {
+    int d = edit_distance(cmd, pool + bk->nodes[cur].key);
+    if (d == 0)
+      return; // Already present
+    uint32_t c = bk->nodes[cur].child;
+    while (c && bk->nodes[c].dist != d)
+      c = bk->nodes[c].next;
+    if (!c) {
+      n.dist = d;
+      n.next = bk->nodes[cur].child;
+      bk->nodes[cur].child = bk->n;
+      if (d > bk->nodes[cur].max_child)
+        bk->nodes[cur].max_child = d;
+      bk->nodes[bk->n++] = n;
+      return;
+    }
+    cur = c;
+  }
+}
 
-  int d = edit_distance(input, root->cmd);
-  if (d < *best_dist) {
+/*
+ * Same answer as find_closest(): smallest distance, then smallest command.
+ * Past best + max_child neither the node nor any child can matter, so the
+ * kernel may stop there.
+ */
+void bk_closest(const BKTree *bk, const char *pool, uint32_t i,
+                const Pattern *input, char *best, int *best_dist) {
+  if (i >= bk->n)
+    return;
+  bk_visited++;
+
+  const BKNode *node = &bk->nodes[i];
+  const char *cmd = pool + node->key;
+  int d = edit_distance_bounded(input, cmd, *best_dist + node->max_child);
+  if (d < *best_dist || (d == *best_dist && strcmp(cmd, best) < 0)) {
     *best_dist = d;
-    strcpy(best, root->cmd);
+    strcpy(best, cmd);
   }
 
-  find_closest(root->right, input, best, best_dist);
+  for (uint32_t c = node->child; c; c = bk->nodes[c].next)
+    if (bk->nodes[c].dist >= d - *best_dist &&
+        bk->nodes[c].dist <= d + *best_dist)
+      bk_closest(bk, pool, c, input, best, best_dist);
 }
 
-void log_rejected(const char *cmd) {
-  FILE *f = fopen(REVIEW_FILE, "a");
-  if (!f)
-    return;
-  time_t t = time(NULL);
-  fprintf(f, "[%ld] REJECTED: %s\n", t, cmd);
-  fclose(f);
+/*
+ * Batch scorer. Keys are grouped by length into structure-of-arrays
+ * buckets: pool offset, a 64-bit bigram signature and the key bytes, one
+ * fixed-stride row per key. A query visits only lengths within the
+ * current best distance of its own, drops keys whose signatures miss too
+ * many of its bigrams, and runs Myers' kernel on the survivors LANES at a
+ * time, one vector lane per candidate.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANES 4
+typedef __m256i vec;
+#define v_store(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+#define v_set1(x) _mm256_set1_epi64x(x)
+#define v_and _mm256_and_si256
+#define v_or _mm256_or_si256
+#define v_xor _mm256_xor_si256
+#define v_add _mm256_add_epi64
+#define v_sub _mm256_sub_epi64
+#define v_shl1(a) _mm256_slli_epi64(a, 1)
+#define v_srl(a, n) _mm256_srl_epi64(a, _mm_cvtsi32_si128(n))
+#define v_peq(p, r, j)                                                         \
+  _mm256_set_epi64x(p[(unsigned char)r[3][j]], p[(unsigned char)r[2][j]],      \
+                    p[(unsigned char)r[1][j]], p[(unsigned char)r[0][j]])
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LANES 2
+typedef __m128i vec;
+#define v_store(p, a) _mm_storeu_si128((__m128i *)(p), a)
+#define v_set1(x) _mm_set1_epi64x(x)
+#define v_and _mm_and_si128
+#define v_or _mm_or_si128
+#define v_xor _mm_xor_si128
+#define v_add _mm_add_epi64
+#define v_sub _mm_sub_epi64
+#define v_shl1(a) _mm_slli_epi64(a, 1)
+#define v_srl(a, n) _mm_srl_epi64(a, _mm_cvtsi32_si128(n))
+#define v_peq(p, r, j)                                                         \
+  _mm_set_epi64x(p[(unsigned char)r[1][j]], p[(unsigned char)r[0][j]])
+#else
+#define LANES 1
+typedef uint64_t vec;
+#define v_store(p, a) (*(p) = (a))
+#define v_set1(x) ((uint64_t)(x))
+#define v_and(a, b) ((a) & (b))
+#define v_or(a, b) ((a) | (b))
+#define v_xor(a, b) ((a) ^ (b))
+#define v_add(a, b) ((a) + (b))
+#define v_sub(a, b) ((a) - (b))
+#define v_shl1(a) ((a) << 1)
+#define v_srl(a, n) ((a) >> (n))
+#define v_peq(p, r, j) (p[(unsigned char)r[0][j]])
+#endif
+
+typedef struct {
+  uint32_t start[MAX_LEN + 1]; // Keys of length l are [start[l], start[l + 1])
+  uint64_t row[MAX_LEN];       // Offset of the first row of length l in text
+  uint32_t *key;               // Pool offset
+  uint64_t *grams;             // Bigram signature
+  char *text;                  // Rows of l bytes, no terminator
+  uint32_t n;
+  uint64_t text_len;
+} KeyStore;
+
+_Thread_local long ks_scored; // Candidates run through the kernel
+
+uint64_t bigrams(const char *s, int len) {
+  uint64_t g = 0;
+  for (int i = 0; i + 1 < len; i++)
+    g |= 1ULL << (((unsigned char)s[i] * 37u + (unsigned char)s[i + 1]) & 63);
+  return g;
+}
+
+// Counting sort of the pool's keys by length; keys keep their pool order.
+void ks_build(KeyStore *ks, const char *pool, size_t pool_len) {
+  uint32_t count[MAX_LEN] = {0}, n = 0;
+  for (size_t off = 0; off < pool_len; off += strlen(pool + off) + 1, n++)
+    count[strlen(pool + off)]++;
+
+  ks->n = n;
+  ks->text_len = 0;
+  for (int l = 0, at = 0; l < MAX_LEN; l++) {
+    ks->start[l] = at;
+    ks->row[l] = ks->text_len;
+    at += count[l];
+    ks->text_len += (uint64_t)count[l] * l;
+  }
+  ks->start[MAX_LEN] = n;
+  ks->key = malloc((n ? n : 1) * sizeof(uint32_t));
+  ks->grams = malloc((n ? n : 1) * sizeof(uint64_t));
+  ks->text = malloc(ks->text_len ? ks->text_len : 1);
+
+  uint32_t fill[MAX_LEN] = {0};
+  for (size_t off = 0; off < pool_len; off += strlen(pool + off) + 1) {
+    int l = strlen(pool + off);
+    uint32_t i = ks->start[l] + fill[l]++;
+    ks->key[i] = (uint32_t)off;
+    ks->grams[i] = bigrams(pool + off, l);
+    memcpy(ks->text + ks->row[l] + (uint64_t)(i - ks->start[l]) * l,
+           pool + off, l);
+  }
+}
+
+/*
+ * Myers' kernel on LANES texts of length n at once, one per lane. Same
+ * recurrence as edit_distance_bounded(); the early exit needs every lane
+ * past bound.
+ */
+void ks_kernel(const Pattern *p, const char *const *row, int n, int bound,
+               uint64_t *out) {
+  vec ones = v_set1(~0ULL), one = v_set1(1), pv = ones, mv = v_set1(0);
+  vec score = v_set1(p->len);
+  int top = p->len - 1;
+  for (int j = 0; j < n; j++) {
+    vec e = v_peq(p->peq, row, j);
+    vec xv = v_or(e, mv);
+    vec xh = v_or(v_xor(v_add(v_and(e, pv), pv), pv), e);
+    vec ph = v_or(mv, v_xor(v_or(xh, pv), ones));
+    vec mh = v_and(pv, xh);
+    score = v_add(score, v_and(v_srl(ph, top), one));
+    score = v_sub(score, v_and(v_srl(mh, top), one));
+    ph = v_or(v_shl1(ph), one);
+    mh = v_shl1(mh);
+    pv = v_or(mh, v_xor(v_or(xv, ph), ones));
+    mv = v_and(ph, xv);
+
+    if ((j & 3) == 3) {
+      // Lanes still within reach have bound + left - score >= 0
+      int64_t slack[LANES];
+      v_store((uint64_t *)slack, v_sub(v_set1(bound + n - j - 1), score));
+      int alive = 0;
+      for (int k = 0; k < LANES; k++)
+        alive |= slack[k] >= 0;
+      if (!alive) {
+        for (int k = 0; k < LANES; k++)
+          out[k] = bound + 1;
+        return;
+      }
+    }
+  }
+  v_store(out, score);
+}
+
+// Scores the first n of the LANES keys in idx, all of length l.
+void ks_score(const KeyStore *ks, const char *pool, const Pattern *p, int l,
+              const uint32_t *idx, int n, char *best, int *best_dist) {
+  uint64_t d[LANES];
+  const char *row[LANES];
+  for (int k = 0; k < LANES; k++) // Idle lanes rescore the first key
+    row[k] = ks->text + ks->row[l] +
+             (uint64_t)(idx[k < n ? k : 0] - ks->start[l]) * l;
+  if (p->len)
+    ks_kernel(p, row, l, *best_dist, d);
+  else
+    for (int k = 0; k < LANES; k++)
+      d[k] = l;
+  ks_scored += n;
+
+  for (int k = 0; k < n; k++) {
+    if ((int)d[k] > *best_dist)
+      continue;
+    // Ties compare the row, which is hot, not the key in the pool
+    int bl = strlen(best), cmp = memcmp(row[k], best, l < bl ? l : bl);
+    if ((int)d[k] < *best_dist || cmp < 0 || (cmp == 0 && l < bl)) {
+      *best_dist = d[k];
+      strcpy(best, pool + ks->key[idx[k]]);
+    }
+  }
 }
 
-void free_tree(Node *root) {
-  if (!root)
+int popcount64(uint64_t x) {
+  x -= (x >> 1) & 0x5555555555555555ULL;
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+/*
+ * Same contract as bk_closest(), for the input cmd compiled into input.
+ * Each edit destroys at most two of the input's bigrams, so a key missing
+ * more than 2 * best_dist of them cannot be within best_dist.
+ */
+void ks_closest(const KeyStore *ks, const char *pool, const char *cmd,
+                const Pattern *input, char *best, int *best_dist) {
+  int m = input->len;
+  uint64_t want = bigrams(cmd, m);
+  uint32_t idx[LANES];
+  // Nearest lengths first, so the bound tightens early
+  for (int k = 0; k <= *best_dist && k < MAX_LEN; k++) {
+    for (int l = m - k; l <= m + k; l += k ? 2 * k : 1) {
+      if (l < 0 || l >= MAX_LEN || k > *best_dist)
+        continue;
+      // Branch-free compaction of the survivors
+      int n = 0, limit = 2 * *best_dist;
+      for (uint32_t i = ks->start[l]; i < ks->start[l + 1]; i++) {
+        idx[n] = i;
+        n += popcount64(want & ~ks->grams[i]) <= limit;
+        if (n == LANES) {
+          ks_score(ks, pool, input, l, idx, n, best, best_dist);
+          n = 0;
+          limit = 2 * *best_dist;
+        }
+      }
+      if (n)
+        ks_score(ks, pool, input, l, idx, n, best, best_dist);
+    }
+  }
+}
+
+/*
+ * The whitelist: every index refers to keys by offset into one string
+ * pool and to nodes by array index, never by pointer, so a built
+ * whitelist can be written to an index file and mapped back as is.
+ */
+typedef struct {
+  char *pool;
+  size_t pool_len, pool_cap;
+  CommandSet set;
+  BTree bt;
+  BKTree bk;
+  KeyStore ks;
+  void *map; // Index file mapping, when loaded from one
+  size_t map_len;
+} Whitelist;
+
+// Identity of the commands.txt an index was built from. Any write to the
+// file moves its ctime; replacing it changes the inode.
+typedef struct {
+  int64_t size, dev, ino;
+  int64_t mtime, mtime_ns, ctime, ctime_ns;
+} SourceStamp;
+
+typedef struct {
+  char magic[4];
+  uint32_t count;
+  SourceStamp src;
+  uint64_t pool_len;
+  uint32_t set_mask, perfect_n, perfect_buckets;
+  uint32_t bt_nodes, bt_root, bk_nodes;
+  uint32_t ks_start[MAX_LEN + 1];
+  uint64_t ks_row[MAX_LEN], ks_text_len;
+  uint64_t off_pool, off_slots, off_seed, off_pkeys, off_bt, off_bk;
+  uint64_t off_ks_key, off_ks_grams, off_ks_text;
+} IndexHeader;
+
+uint32_t pool_add(Whitelist *wl, const char *cmd, size_t len) {
+  if (wl->pool_len + len + 1 > wl->pool_cap) {
+    wl->pool_cap = wl->pool_cap ? wl->pool_cap * 2 : 4096;
+    if (wl->pool_cap < wl->pool_len + len + 1)
+      wl->pool_cap = wl->pool_len + len + 1;
+    wl->pool = realloc(wl->pool, wl->pool_cap);
+  }
+  uint32_t off = (uint32_t)wl->pool_len;
+  memcpy(wl->pool + off, cmd, len);
+  wl->pool[off + len] = '\0';
+  wl->pool_len += len + 1;
+  return off;
+}
+
+// Incremental insert into every index but the key store, which
+// ks_build() lays out once all keys are in.
+void wl_add(Whitelist *wl, const char *cmd) {
+  if (set_contains(&wl->set, wl->pool, cmd))
     return;
-  free_tree(root->left);
-  free_tree(root->right);
-  free(root);
+  uint32_t off = pool_add(wl, cmd, strlen(cmd));
+  set_insert(&wl->set, wl->pool, off);
+  bt_insert(&wl->bt, wl->pool, off);
+  bk_insert(&wl->bk, wl->pool, off);
+}
+
+typedef struct {
+  const char *s;
+  uint32_t len;
+} KeyRef;
+
+// Same order as strcmp() on the NUL-terminated keys.
+int keyref_cmp(const void *a, const void *b) {
+  const KeyRef *x = a, *y = b;
+  int c = memcmp(x->s, y->s, x->len < y->len ? x->len : y->len);
+  return c ? c : (int)x->len - (int)y->len;
+}
+
+uint32_t gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+/*
+ * Bulk build from unsorted key references: one sort, then the pool, hash
+ * set and B-tree are each filled in a single pass. The BK-tree still
+ * needs one insert per key; keys go in with a fixed stride so the
+ * sorted order does not skew its shape.
+ */
+void wl_build(Whitelist *wl, KeyRef *refs, uint32_t n) {
+  qsort(refs, n, sizeof(KeyRef), keyref_cmp);
+  uint32_t *offs = malloc((n ? n : 1) * sizeof(uint32_t)), m = 0;
+  for (uint32_t i = 0; i < n; i++)
+    if (i == 0 || keyref_cmp(&refs[i - 1], &refs[i]) != 0)
+      offs[m++] = pool_add(wl, refs[i].s, refs[i].len);
+
+  set_resize(&wl->set, wl->pool, m);
+  for (uint32_t i = 0; i < m; i++)
+    set_place(&wl->set, hash_str(wl->pool + offs[i]), offs[i] + 1);
+  wl->set.count = m;
+
+  bt_build(&wl->bt, wl->pool, offs, m);
+
+  // Any stride coprime to m visits every key once
+  uint32_t stride = m > 1 ? 2654435761u % m : 1;
+  while (m > 1 && gcd(stride, m) != 1)
+    stride = stride % (m - 1) + 1;
+  for (uint32_t i = 0, k = 0; i < m; i++, k = (k + stride) % m)
+    bk_insert(&wl->bk, wl->pool, offs[k]);
+  free(offs);
+  ks_build(&wl->ks, wl->pool, wl->pool_len);
 }
 
-int main() {
+/*
+ * Loads a text whitelist without copying lines: the file is mapped and
+ * keys are referenced in place until the build copies them into the pool.
+ * Lines are cut at MAX_LEN - 1 bytes, as fgets() did; empty lines are
+ * skipped.
+ */
+int wl_load_text(Whitelist *wl, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return 0;
+  }
 
-  Node *root = NULL;
-  FILE *file = fopen("commands.txt", "r");
-  char buffer[MAX_LEN];
+  size_t size = st.st_size;
+  const char *text = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                          : "";
+  close(fd);
+  if (text == MAP_FAILED)
+    return 0;
 
-  if (file) {
-    while (fgets(buffer, sizeof(buffer), file)) {
-      buffer[strcspn(buffer, "\n")] = 0;
-      root = insert(root, buffer);
+  uint32_t n = 0, cap = 1024;
+  KeyRef *refs = malloc(cap * sizeof(KeyRef));
+  for (const char *p = text, *end = text + size; p < end;) {
+    const char *nl = memchr(p, '\n', end - p);
+    if (!nl)
+      nl = end;
+    size_t len = nl - p;
+    if (len > MAX_LEN - 1)
+      len = MAX_LEN - 1;
+    if (len > 0) {
+      if (n == cap)
+        refs = realloc(refs, (cap *= 2) * sizeof(KeyRef));
+      refs[n++] = (KeyRef){p, (uint32_t)len};
     }
-    fclose(file);
+    p = nl + 1;
+  }
+
+  wl_build(wl, refs, n);
+  free(refs);
+  if (size)
+    munmap((void *)text, size);
+  return 1;
+}
+
+SourceStamp src_stamp(const struct stat *st) {
+  SourceStamp s = {st->st_size,         st->st_dev,          st->st_ino,
+                   st->st_mtim.tv_sec,  st->st_mtim.tv_nsec, st->st_ctim.tv_sec,
+                   st->st_ctim.tv_nsec};
+  return s;
+}
+
+size_t align_up(size_t x) {
+  return (x + INDEX_ALIGN - 1) & ~(size_t)(INDEX_ALIGN - 1);
+}
+
+// Writes the built whitelist as an index file that wl_map() can map.
+int wl_save(const Whitelist *wl, const char *path, const struct stat *src) {
+  const CommandSet *s = &wl->set;
+  IndexHeader h = {.count = s->count,
+                   .pool_len = wl->pool_len,
+                   .set_mask = s->mask,
+                   .perfect_n = s->perfect.n,
+                   .perfect_buckets = s->perfect.n_buckets,
+                   .bt_nodes = wl->bt.n_nodes,
+                   .bt_root = wl->bt.root,
+                   .bk_nodes = wl->bk.n,
+                   .ks_text_len = wl->ks.text_len};
+  memcpy(h.magic, INDEX_MAGIC, 4);
+  if (src)
+    h.src = src_stamp(src);
+  else
+    memset(&h.src, 0xFF, sizeof(h.src));
+  memcpy(h.ks_start, wl->ks.start, sizeof(h.ks_start));
+  memcpy(h.ks_row, wl->ks.row, sizeof(h.ks_row));
+
+  struct {
+    const void *data;
+    size_t len;
+    uint64_t *off;
+  } sec[] = {
+      {wl->pool, wl->pool_len, &h.off_pool},
+      {s->slots, s->slots ? (s->mask + 1) * sizeof(Slot) : 0, &h.off_slots},
+      {s->perfect.seed, s->perfect.n_buckets * sizeof(uint32_t), &h.off_seed},
+      {s->perfect.keys, s->perfect.n * sizeof(uint32_t), &h.off_pkeys},
+      {wl->bt.nodes, wl->bt.n_nodes * sizeof(BTNode), &h.off_bt},
+      {wl->bk.nodes, wl->bk.n * sizeof(BKNode), &h.off_bk},
+      {wl->ks.key, wl->ks.n * sizeof(uint32_t), &h.off_ks_key},
+      {wl->ks.grams, wl->ks.n * sizeof(uint64_t), &h.off_ks_grams},
+      {wl->ks.text, wl->ks.text_len, &h.off_ks_text},
+  };
+  int n_sec = sizeof(sec) / sizeof(sec[0]);
+  size_t at = align_up(sizeof(h));
+  for (int i = 0; i < n_sec; i++) {
+    *sec[i].off = at;
+    at = align_up(at + sec[i].len);
+  }
+
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return 0;
+  static const char zero[INDEX_ALIGN];
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  size_t pos = sizeof(h);
+  for (int i = 0; ok && i < n_sec; i++) {
+    ok = fwrite(zero, 1, *sec[i].off - pos, f) == *sec[i].off - pos &&
+         (!sec[i].len || fwrite(sec[i].data, 1, sec[i].len, f) == sec[i].len);
+    pos = *sec[i].off + sec[i].len;
+  }
+  ok = fclose(f) == 0 && ok;
+  // Readers see either the old index or the complete new one
+  if (!ok || rename(tmp, path) != 0) {
+    remove(tmp);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Checks everything lookups will dereference in a mapped index: pool
+ * strings, every pool offset, slot and node index, and that both trees
+ * are trees (each node reached at most once from the root).
+ */
+int wl_check(const IndexHeader *h, const char *base) {
+  const char *pool = base + h->off_pool;
+  uint64_t plen = h->pool_len;
+  if (plen > UINT32_MAX || (h->count && !plen) ||
+      (plen && pool[plen - 1] != '\0'))
+    return 0;
+  // Keys are copied into MAX_LEN buffers
+  for (uint64_t i = 0, len = 0; i < plen; i++, len++) {
+    if (!pool[i])
+      len = (uint64_t)-1;
+    else if (len >= MAX_LEN - 1)
+      return 0;
+  }
+
+  if (h->count) {
+    // Probing ends at an empty slot, so the table must have one
+    const Slot *sl = (const Slot *)(base + h->off_slots);
+    uint64_t used = 0;
+    if (h->set_mask & (h->set_mask + 1))
+      return 0;
+    for (uint64_t i = 0; i <= h->set_mask; i++) {
+      if (sl[i].key && sl[i].key - 1 >= plen)
+        return 0;
+      used += sl[i].key != 0;
+    }
+    if (used != h->count || used > h->set_mask)
+      return 0;
+  }
+  if (h->perfect_n && (!h->perfect_buckets || h->perfect_n != h->count))
+    return 0;
+  const uint32_t *pkeys = (const uint32_t *)(base + h->off_pkeys);
+  for (uint32_t i = 0; i < h->perfect_n; i++)
+    if (pkeys[i] >= plen)
+      return 0;
+  const uint32_t *ks_key = (const uint32_t *)(base + h->off_ks_key);
+  for (uint32_t i = 0; i < h->count; i++)
+    if (ks_key[i] >= plen)
+      return 0;
+
+  if ((h->count && !h->bt_nodes) || (h->bt_nodes && h->bt_root >= h->bt_nodes))
+    return 0;
+  uint32_t most = h->bt_nodes > h->bk_nodes ? h->bt_nodes : h->bk_nodes;
+  char *seen = calloc(most ? most : 1, 1);
+  uint32_t *stack = malloc(sizeof(uint32_t) * (most ? most : 1));
+  int ok = seen && stack;
+
+  const BTNode *bt = (const BTNode *)(base + h->off_bt);
+  uint32_t top = 0;
+  if (ok && h->bt_nodes) {
+    seen[h->bt_root] = 1;
+    stack[top++] = h->bt_root;
+  }
+  while (ok && top) {
+    const BTNode *x = &bt[stack[--top]];
+    ok = x->n >= 0 && x->n <= BT_MAX && (x->leaf == 1 || (!x->leaf && x->n));
+    for (int i = 0; ok && i < x->n; i++)
+      ok = x->key[i] < plen;
+    for (int i = 0; ok && !x->leaf && i <= x->n; i++) {
+      uint32_t c = x->child[i];
+      ok = c < h->bt_nodes && !seen[c];
+      if (ok) {
+        seen[c] = 1;
+        stack[top++] = c;
+      }
+    }
+  }
+
+  // BK-tree: node 0 is the root, and 0 also ends a child or sibling chain
+  const BKNode *bk = (const BKNode *)(base + h->off_bk);
+  if (ok)
+    memset(seen, 0, most ? most : 1);
+  for (uint32_t i = 0; ok && i < h->bk_nodes; i++)
+    ok = bk[i].key < plen;
+  top = 0;
+  if (ok && h->bk_nodes) {
+    seen[0] = 1;
+    stack[top++] = 0;
+  }
+  while (ok && top) {
+    for (uint32_t c = bk[stack[--top]].child; ok && c; c = bk[c].next) {
+      ok = c < h->bk_nodes && !seen[c];
+      if (ok) {
+        seen[c] = 1;
+        stack[top++] = c;
+      }
+    }
+  }
+  free(seen);
+  free(stack);
+  return ok;
+}
+
+/*
+ * Maps an index file read-only and points every structure into it; no
+ * key is parsed or hashed. Refuses an index built from a different
+ * commands.txt when the source is known, and any section that does not
+ * lie inside the file.
+ */
+int wl_map(Whitelist *wl, const char *path, const struct stat *src) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  const IndexHeader *h = map;
+  SourceStamp want = src ? src_stamp(src) : h->src;
+  int ok = memcmp(h->magic, INDEX_MAGIC, 4) == 0 &&
+           memcmp(&h->src, &want, sizeof(want)) == 0;
+
+  struct {
+    uint64_t off, len;
+  } sec[] = {
+      {h->off_pool, h->pool_len},
+      {h->off_slots, h->count ? ((uint64_t)h->set_mask + 1) * sizeof(Slot) : 0},
+      {h->off_seed, (uint64_t)h->perfect_buckets * sizeof(uint32_t)},
+      {h->off_pkeys, (uint64_t)h->perfect_n * sizeof(uint32_t)},
+      {h->off_bt, (uint64_t)h->bt_nodes * sizeof(BTNode)},
+      {h->off_bk, (uint64_t)h->bk_nodes * sizeof(BKNode)},
+      {h->off_ks_key, (uint64_t)h->count * sizeof(uint32_t)},
+      {h->off_ks_grams, (uint64_t)h->count * sizeof(uint64_t)},
+      {h->off_ks_text, h->ks_text_len},
+  };
+  uint64_t size = st.st_size;
+  for (size_t i = 0; ok && i < sizeof(sec) / sizeof(sec[0]); i++)
+    ok = sec[i].off % INDEX_ALIGN == 0 && sec[i].off <= size &&
+         sec[i].len <= size - sec[i].off;
+  // Key store rows of each length must lie inside its key and text arrays
+  ok = ok && h->ks_start[MAX_LEN] == h->count;
+  for (int l = 0; ok && l < MAX_LEN; l++)
+    ok = h->ks_start[l] <= h->ks_start[l + 1] &&
+         h->ks_row[l] <= h->ks_text_len &&
+         (uint64_t)(h->ks_start[l + 1] - h->ks_start[l]) * l <=
+             h->ks_text_len - h->ks_row[l];
+  if (!ok || !wl_check(h, map)) {
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  char *base = map;
+  wl->map = map;
+  wl->map_len = st.st_size;
+  wl->pool = base + h->off_pool;
+  wl->pool_len = wl->pool_cap = h->pool_len;
+  wl->set.slots = h->count ? (Slot *)(base + h->off_slots) : NULL;
+  wl->set.mask = h->set_mask;
+  wl->set.count = h->count;
+  wl->set.perfect.n = h->perfect_n;
+  wl->set.perfect.n_buckets = h->perfect_buckets;
+  wl->set.perfect.seed = h->perfect_n ? (uint32_t *)(base + h->off_seed) : NULL;
+  wl->set.perfect.keys = h->perfect_n ? (uint32_t *)(base + h->off_pkeys) : NULL;
+  wl->bt.nodes = (BTNode *)(base + h->off_bt);
+  wl->bt.n_nodes = wl->bt.cap = h->bt_nodes;
+  wl->bt.root = h->bt_root;
+  wl->bt.count = h->count;
+  wl->bk.nodes = (BKNode *)(base + h->off_bk);
+  wl->bk.n = wl->bk.cap = h->bk_nodes;
+  memcpy(wl->ks.start, h->ks_start, sizeof(h->ks_start));
+  memcpy(wl->ks.row, h->ks_row, sizeof(h->ks_row));
+  wl->ks.n = h->count;
+  wl->ks.text_len = h->ks_text_len;
+  wl->ks.key = (uint32_t *)(base + h->off_ks_key);
+  wl->ks.grams = (uint64_t *)(base + h->off_ks_grams);
+  wl->ks.text = base + h->off_ks_text;
+  return 1;
+}
+
+// Frees what is heap-allocated; anything inside the index mapping is not.
+void wl_release(const Whitelist *wl, void *p) {
+  char *c = p, *m = wl->map;
+  if (!m || c < m || c >= m + wl->map_len)
+    free(p);
+}
+
+void wl_free(Whitelist *wl) {
+  wl_release(wl, wl->pool);
+  wl_release(wl, wl->set.slots);
+  wl_release(wl, wl->set.perfect.seed);
+  wl_release(wl, wl->set.perfect.keys);
+  wl_release(wl, wl->bt.nodes);
+  wl_release(wl, wl->bk.nodes);
+  wl_release(wl, wl->ks.key);
+  wl_release(wl, wl->ks.grams);
+  wl_release(wl, wl->ks.text);
+  if (wl->map)
+    munmap(wl->map, wl->map_len);
+  memset(wl, 0, sizeof(*wl));
+}
+
+void wl_report(const Whitelist *wl) {
+  size_t bytes = wl->bt.n_nodes * sizeof(BTNode) + wl->pool_len;
+  uint32_t n = wl->bt.count;
+  printf("Loaded %u commands: B-tree depth %d, %u nodes, %.1f bytes/key\n", n,
+         bt_depth(&wl->bt), wl->bt.n_nodes, n ? (double)bytes / n : 0.0);
+}
+
+/*
+ * A fresh index file is mapped as is. Otherwise commands.txt is bulk
+ * loaded and, with --index, compiled for the next start. The result is
+ * read-only from here on.
+ */
+Whitelist *wl_open(const char *index_path, int perfect, const char **from) {
+  Whitelist *wl = calloc(1, sizeof(Whitelist));
+  struct stat src;
+  int have_src = stat(COMMAND_FILE, &src) == 0;
+  *from = "defaults";
+
+  if (index_path && wl_map(wl, index_path, have_src ? &src : NULL)) {
+    *from = index_path;
+  } else if (have_src && wl_load_text(wl, COMMAND_FILE)) {
+    *from = COMMAND_FILE;
+    if (perfect && !perfect_build(&wl->set, wl->pool))
+      printf("Perfect hash build failed; using the hash set.\n");
+    if (index_path && !wl_save(wl, index_path, &src))
+      printf("Could not write index %s\n", index_path);
   } else {
     const char *defaults[] = {
         "START_UP",       "STOP_CONVEYOR",  "RESET_ALARM",  "PAUSE_PROCESS",
         "RESUME_PROCESS", "EMERGENCY_STOP", "CHECK_STATUS", NULL};
     for (int i = 0; defaults[i]; i++)
-      root = insert(root, defaults[i]);
+      wl_add(wl, defaults[i]);
+    ks_build(&wl->ks, wl->pool, wl->pool_len);
+  }
+
+  if (perfect && !wl->set.perfect.n && !perfect_build(&wl->set, wl->pool))
+    printf("Perfect hash build failed; using the hash set.\n");
+  return wl;
+}
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Rejected-command audit log. log_rejected() only copies the entry into a
+ * bounded queue and never waits: when the queue is full the entry is
+ * counted as dropped. A writer thread drains the queue in batches, formats
+ * them into one buffer, writes it with a single write() and syncs per the
+ * fsync policy.
+ */
+typedef struct {
+  time_t when;
+  char cmd[MAX_LEN];
+} AuditEntry;
+
+typedef struct {
+  AuditEntry *q; // Ring of cap entries
+  uint32_t cap, head, count;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int fd;
+  int fsync_ms; // -1 never, 0 after every batch, > 0 at most every N ms
+  int stop;
+  uint64_t logged, written, dropped, batches, syncs;
+  pthread_t thread;
+} AuditLog;
+
+AuditLog audit = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                  .ready = PTHREAD_COND_INITIALIZER,
+                  .fd = -1};
+
+void log_rejected(const char *cmd) {
+  pthread_mutex_lock(&audit.lock);
+  if (audit.count == audit.cap) {
+    audit.dropped++;
+  } else {
+    AuditEntry *e = &audit.q[(audit.head + audit.count) % audit.cap];
+    e->when = time(NULL);
+    snprintf(e->cmd, sizeof(e->cmd), "%s", cmd);
+    if (audit.count++ == 0)
+      pthread_cond_signal(&audit.ready);
+    audit.logged++;
+  }
+  pthread_mutex_unlock(&audit.lock);
+}
+
+void audit_write(const char *buf, size_t len) {
+  if (len && write(audit.fd, buf, len) != (ssize_t)len)
+    perror(REVIEW_FILE);
+}
+
+void *audit_writer(void *arg) {
+  (void)arg;
+  AuditEntry *batch = malloc(audit.cap * sizeof(AuditEntry));
+  char *buf = malloc(AUDIT_BUF);
+  double last_sync = now_sec();
+  int dirty = 0, stop = 0;
+
+  while (!stop) {
+    pthread_mutex_lock(&audit.lock);
+    while (audit.count == 0 && !audit.stop) {
+      if (dirty && audit.fsync_ms > 0) {
+        // Wake up in time for the pending sync
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += audit.fsync_ms * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait(&audit.ready, &audit.lock, &ts) != 0)
+          break;
+      } else {
+        pthread_cond_wait(&audit.ready, &audit.lock);
+      }
+    }
+    uint32_t n = 0;
+    for (; n < audit.count; n++)
+      batch[n] = audit.q[(audit.head + n) % audit.cap];
+    audit.head = (audit.head + n) % audit.cap;
+    audit.count = 0;
+    stop = audit.stop;
+    pthread_mutex_unlock(&audit.lock);
+
+    size_t len = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (len + MAX_LEN + 48 > AUDIT_BUF) {
+        audit_write(buf, len);
+        len = 0;
+      }
+      len += snprintf(buf + len, AUDIT_BUF - len, "[%ld] REJECTED: %s\n",
+                      (long)batch[i].when, batch[i].cmd);
+    }
+    audit_write(buf, len);
+    if (n) {
+      audit.batches++;
+      dirty = 1;
+    }
+
+    pthread_mutex_lock(&audit.lock);
+    audit.written += n;
+    pthread_mutex_unlock(&audit.lock);
+
+    if (dirty && audit.fsync_ms >= 0 &&
+        (audit.fsync_ms == 0 || stop ||
+         now_sec() - last_sync >= audit.fsync_ms / 1e3)) {
+      fdatasync(audit.fd);
+      audit.syncs++;
+      last_sync = now_sec();
+      dirty = 0;
+    }
+  }
+  free(batch);
+  free(buf);
+  return NULL;
+}
+
+int audit_start(uint32_t cap, int fsync_ms) {
+  audit.fd = open(REVIEW_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (audit.fd < 0) {
+    perror(REVIEW_FILE);
+    return 0; // cap stays 0, so every entry counts as dropped
+  }
+  audit.q = malloc(cap * sizeof(AuditEntry));
+  audit.cap = cap;
+  audit.fsync_ms = fsync_ms;
+  pthread_create(&audit.thread, NULL, audit_writer, NULL);
+  return 1;
+}
+
+void audit_stop() {
+  if (audit.fd >= 0) {
+    pthread_mutex_lock(&audit.lock);
+    audit.stop = 1;
+    pthread_cond_signal(&audit.ready);
+    pthread_mutex_unlock(&audit.lock);
+    pthread_join(audit.thread, NULL);
+    close(audit.fd);
+  }
+  printf("Audit: %llu logged, %llu written, %llu dropped, %llu batches, "
+         "%llu fsyncs\n",
+         (unsigned long long)audit.logged, (unsigned long long)audit.written,
+         (unsigned long long)audit.dropped, (unsigned long long)audit.batches,
+         (unsigned long long)audit.syncs);
+  free(audit.q);
+}
+
+// Synthetic PLC-style whitelist, e.g. "RESET_PUMP_0042".
+void make_command(char *out, unsigned r) {
+  static const char *verbs[] = {"START", "STOP",  "RESET", "PAUSE",
+                                "RESUME", "CHECK", "OPEN",  "CLOSE",
+                                "SET",    "READ",  "ARM",   "BYPASS"};
+  static const char *nouns[] = {"CONVEYOR", "ALARM",  "PUMP",   "VALVE",
+                                "MOTOR",    "HEATER", "FAN",    "BELT",
+                                "SENSOR",   "DRIVE",  "FEEDER", "PRESS"};
+  snprintf(out, MAX_LEN, "%s_%s_%04u", verbs[r % 12], nouns[r / 12 % 12],
+           r / 144 % 10000);
+}
+
+// One to THRESHOLD random substitutions, insertions or deletions.
+void mutate(char *s, unsigned *seed) {
+  int edits = 1 + rand_r(seed) % THRESHOLD;
+  for (int e = 0; e < edits; e++) {
+    int len = strlen(s);
+    int at = rand_r(seed) % (len + 1);
+    switch (rand_r(seed) % 3) {
+    case 0:
+      if (at < len)
+        s[at] = 'A' + rand_r(seed) % 26;
+      break;
+    case 1:
+      if (len + 1 < MAX_LEN) {
+        memmove(s + at + 1, s + at, len - at + 1);
+        s[at] = 'A' + rand_r(seed) % 26;
+      }
+      break;
+    default:
+      if (at < len)
+        memmove(s + at, s + at + 1, len - at);
+    }
+  }
+}
+
+// Incremental vs bulk build, exact lookups, and exhaustive scan vs BK-tree
+// on n synthetic commands.
+void run_bench(int n) {
+  Whitelist inc = {0}, wl = {0};
+  char cmd[MAX_LEN];
+  unsigned seed = 7;
+
+  double t0 = now_sec();
+  for (int i = 0; i < n; i++) {
+    make_command(cmd, rand_r(&seed));
+    wl_add(&inc, cmd);
+  }
+  double t_inc = now_sec() - t0;
+
+  // Bulk: keys referenced in one text buffer, as wl_load_text() sees them
+  char *text = malloc((size_t)n * MAX_LEN);
+  KeyRef *refs = malloc(n * sizeof(KeyRef));
+  seed = 7;
+  for (int i = 0; i < n; i++) {
+    make_command(text + (size_t)i * MAX_LEN, rand_r(&seed));
+    refs[i] = (KeyRef){text + (size_t)i * MAX_LEN,
+                       (uint32_t)strlen(text + (size_t)i * MAX_LEN)};
+  }
+  t0 = now_sec();
+  wl_build(&wl, refs, n);
+  double t_bulk = now_sec() - t0;
+  free(refs);
+  free(text);
+
+  t0 = now_sec();
+  CommandSet mph = {.slots = wl.set.slots, .mask = wl.set.mask,
+                    .count = wl.set.count};
+  int built = perfect_build(&mph, wl.pool);
+  double t_mph = now_sec() - t0;
+
+  // Index file round trip
+  char path[] = "/tmp/authz_bench_XXXXXX";
+  int fd = mkstemp(path);
+  double t_save = 0, t_map = 0;
+  Whitelist mapped = {0};
+  if (fd >= 0) {
+    close(fd);
+    t0 = now_sec();
+    wl_save(&wl, path, NULL);
+    t_save = now_sec() - t0;
+    t0 = now_sec();
+    wl_map(&mapped, path, NULL);
+    t_map = now_sec() - t0;
+    remove(path);
+  }
+
+  printf("Commands: %d, threshold: %d\n", n, THRESHOLD);
+  wl_report(&wl);
+  printf("Build:  incremental %.1f ms, bulk %.1f ms, perfect hash %.1f ms%s\n",
+         t_inc * 1e3, t_bulk * 1e3, t_mph * 1e3, built ? "" : " (failed)");
+  printf("Index:  save %.1f ms, map %.3f ms (%.1f MiB)\n", t_save * 1e3,
+         t_map * 1e3, mapped.map_len / 1048576.0);
+
+  // Exact lookups, half present and half absent
+  enum { LOOKUPS = 100000 };
+  static char keys[LOOKUPS][MAX_LEN];
+  unsigned lseed = 7;
+  for (int i = 0; i < LOOKUPS; i++)
+    make_command(keys[i], i % 2 ? rand_r(&lseed) : rand_r(&lseed) + 1);
+
+  long found[4] = {0};
+  double t_look[4] = {0};
+  t0 = now_sec();
+  for (int i = 0; i < LOOKUPS; i++)
+    found[0] += bt_search(&wl.bt, wl.pool, keys[i]);
+  t_look[0] = now_sec() - t0;
+  t0 = now_sec();
+  for (int i = 0; i < LOOKUPS; i++)
+    found[1] += set_contains(&wl.set, wl.pool, keys[i]);
+  t_look[1] = now_sec() - t0;
+  t0 = now_sec();
+  for (int i = 0; built && i < LOOKUPS; i++)
+    found[2] += set_contains(&mph, wl.pool, keys[i]);
+  t_look[2] = now_sec() - t0;
+  for (int i = 0; mapped.map && i < LOOKUPS; i++)
+    found[3] += set_contains(&mapped.set, mapped.pool, keys[i]) +
+                bt_search(&mapped.bt, mapped.pool, keys[i]);
+  printf("Lookup: B-tree %.0f ns, hash set %.0f ns, perfect hash %.0f ns "
+         "(%ld/%ld/%ld found, mapped index %s)\n",
+         t_look[0] * 1e9 / LOOKUPS, t_look[1] * 1e9 / LOOKUPS,
+         t_look[2] * 1e9 / LOOKUPS, found[0], found[1], found[2],
+         found[3] == 2 * found[1] ? "agrees" : "DIFFERS");
+
+  enum { QUERIES = 200 };
+  static char queries[QUERIES][MAX_LEN];
+  for (int q = 0; q < QUERIES; q++) {
+    make_command(queries[q], rand_r(&seed) % (unsigned)(n * 2));
+    mutate(queries[q], &seed);
+  }
+
+  // Kernels: full DP vs bit-parallel, unbounded and with the threshold
+  int bad = 0;
+  double t_dp = 0, t_myers = 0, t_bounded = 0;
+  for (int q = 0; q < QUERIES; q++) {
+    Pattern p;
+    pattern_init(&p, queries[q]);
+    for (int k = 0; k < 500; k++) {
+      make_command(cmd, rand_r(&seed));
+      t0 = now_sec();
+      int a = edit_distance_dp(queries[q], cmd);
+      t_dp += now_sec() - t0;
+      t0 = now_sec();
+      int b = edit_distance_bounded(&p, cmd, MAX_LEN);
+      t_myers += now_sec() - t0;
+      t0 = now_sec();
+      int c = edit_distance_bounded(&p, cmd, THRESHOLD);
+      t_bounded += now_sec() - t0;
+      bad += a != b || (a <= THRESHOLD ? c != a : c != THRESHOLD + 1);
+    }
+  }
+  int pairs = QUERIES * 500;
+  printf("Kernel: DP %.0f ns, Myers %.0f ns, Myers bounded(%d) %.0f ns per "
+         "pair, %d wrong\n",
+         t_dp * 1e9 / pairs, t_myers * 1e9 / pairs, THRESHOLD,
+         t_bounded * 1e9 / pairs, bad);
+
+  int mismatches = 0;
+  double t_scan = 0, t_tree = 0, t_batch = 0;
+  bk_visited = ks_scored = 0;
+  for (int q = 0; q < QUERIES; q++) {
+    char best_a[MAX_LEN] = "", best_b[MAX_LEN] = "", best_c[MAX_LEN] = "";
+    int dist_a = INT_MAX, dist_b = THRESHOLD + 1, dist_c = THRESHOLD + 1;
+    Pattern p;
+    pattern_init(&p, queries[q]);
+
+    t0 = now_sec();
+    find_closest(&wl.bt, wl.pool, wl.bt.root, &p, best_a, &dist_a);
+    t_scan += now_sec() - t0;
+
+    t0 = now_sec();
+    bk_closest(&wl.bk, wl.pool, 0, &p, best_b, &dist_b);
+    t_tree += now_sec() - t0;
+
+    t0 = now_sec();
+    ks_closest(&wl.ks, wl.pool, queries[q], &p, best_c, &dist_c);
+    t_batch += now_sec() - t0;
+
+    int hit_a = dist_a <= THRESHOLD, hit_b = dist_b <= THRESHOLD,
+        hit_c = dist_c <= THRESHOLD;
+    if (hit_a != hit_b || (hit_a && (dist_a != dist_b ||
+                                     strcmp(best_a, best_b) != 0)))
+      mismatches++;
+    if (hit_a != hit_c || (hit_a && (dist_a != dist_c ||
+                                     strcmp(best_a, best_c) != 0)))
+      mismatches++;
+  }
+  printf("Scan:    %8.3f ms/query, %u nodes/query\n", t_scan * 1e3 / QUERIES,
+         wl.bt.count);
+  printf("BK-tree: %8.3f ms/query, %ld nodes/query (%.1f%%)\n",
+         t_tree * 1e3 / QUERIES, bk_visited / QUERIES,
+         100.0 * bk_visited / QUERIES / wl.bt.count);
+  printf("Batch:   %8.3f ms/query, %ld scored/query (%.1f%%), %d lanes\n",
+         t_batch * 1e3 / QUERIES, ks_scored / QUERIES,
+         100.0 * ks_scored / QUERIES / wl.bt.count, LANES);
+  printf("Mismatches: %d\n", mismatches);
+
+  free(mph.perfect.seed);
+  free(mph.perfect.keys);
+  wl_free(&mapped);
+  wl_free(&inc);
+  wl_free(&wl);
+}
+
+enum { AUTHORIZED, SUGGESTED, REJECTED };
+
+int suggest_batch; // Suggest through the key store, not the BK-tree
+
+// One authorization decision; on SUGGESTED best holds the closest command.
+int authorize(const Whitelist *wl, const char *cmd, char *best) {
+  if (set_contains(&wl->set, wl->pool, cmd))
+    return AUTHORIZED;
+
+  int best_dist = THRESHOLD + 1;
+  Pattern p;
+  pattern_init(&p, cmd);
+  best[0] = '\0';
+  if (suggest_batch)
+    ks_closest(&wl->ks, wl->pool, cmd, &p, best, &best_dist);
+  else
+    bk_closest(&wl->bk, wl->pool, 0, &p, best, &best_dist);
+  if (best_dist > 0 && best_dist <= THRESHOLD)
+    return SUGGESTED;
+  log_rejected(cmd);
+  return REJECTED;
+}
+
+/*
+ * Server mode: clients send one command per line over a Unix domain
+ * socket and get "AUTHORIZED", "SUGGEST <command>" or "REJECTED" back.
+ * The acceptor deals connections round robin to a fixed pool of workers,
+ * each multiplexing its share through its own epoll set.
+ *
+ * Reloads are RCU style. A worker publishes the epoch it entered in and
+ * then loads the whitelist pointer, without locks. The reloader swaps in
+ * the new whitelist, advances the epoch and frees the old one once no
+ * worker is still inside an older epoch, so readers never wait.
+ */
+typedef struct {
+  pthread_t thread;
+  _Atomic uint64_t epoch; // Epoch of the running lookup, 0 when idle
+  int ep;                 // epoll set of this worker's connections
+  uint64_t served;
+} Worker;
+
+typedef struct {
+  size_t len; // Bytes of an incomplete line carried to the next read
+  char buf[SERVE_BUF];
+} Conn;
+
+typedef struct {
+  _Atomic(Whitelist *) wl;
+  _Atomic uint64_t epoch;
+  Worker workers[MAX_WORKERS];
+  int n_workers;
+  // By file descriptor. The acceptor fills a slot before handing the fd
+  // to a worker; from then on only that worker touches it.
+  _Atomic(Conn *) conns[MAX_CONNS];
+  _Atomic int stop, reload; // Set from signal handlers
+  const char *index_path;
+  int perfect;
+  uint64_t reloads;
+} Server;
+
+Server server = {.epoch = 1};
+
+Whitelist *rcu_enter(Worker *w) {
+  atomic_store(&w->epoch, atomic_load(&server.epoch));
+  return atomic_load(&server.wl);
+}
+
+void rcu_exit(Worker *w) { atomic_store(&w->epoch, 0); }
+
+// Publishes fresh; the old whitelist is freed after the grace period.
+void rcu_swap(Whitelist *fresh) {
+  Whitelist *old = atomic_exchange(&server.wl, fresh);
+  uint64_t e = atomic_fetch_add(&server.epoch, 1) + 1;
+  for (int i = 0; i < server.n_workers; i++) {
+    uint64_t seen;
+    while ((seen = atomic_load(&server.workers[i].epoch)) && seen < e)
+      sched_yield();
+  }
+  wl_free(old);
+  free(old);
+}
+
+int send_all(int fd, const char *buf, size_t len) {
+  while (len) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Answers every complete line one read() brings in with a single send.
+ * Lines are cut to MAX_LEN - 1 bytes; a line that fills the whole buffer
+ * is dropped. Returns -1 once the connection should be closed.
+ */
+int serve_conn(Worker *w, int fd, Conn *c, char *out) {
+  ssize_t got = read(fd, c->buf + c->len, SERVE_BUF - c->len);
+  if (got <= 0)
+    return -1;
+
+  size_t end = c->len + got, start = 0, len = 0;
+  char best[MAX_LEN];
+  char *nl;
+  while ((nl = memchr(c->buf + start, '\n', end - start))) {
+    char *line = c->buf + start;
+    *nl = '\0';
+    if (nl - line >= MAX_LEN)
+      line[MAX_LEN - 1] = '\0';
+    start = nl - c->buf + 1;
+
+    Whitelist *wl = rcu_enter(w);
+    int verdict = authorize(wl, line, best);
+    rcu_exit(w);
+
+    len += snprintf(out + len, SERVE_BUF - len, "%s%s\n",
+                    verdict == AUTHORIZED  ? "AUTHORIZED"
+                    : verdict == SUGGESTED ? "SUGGEST "
+                                           : "REJECTED",
+                    verdict == SUGGESTED ? best : "");
+    w->served++;
+    if (len + MAX_LEN + 16 > SERVE_BUF) {
+      if (send_all(fd, out, len) < 0)
+        return -1;
+      len = 0;
+    }
+  }
+  if (send_all(fd, out, len) < 0)
+    return -1;
+
+  c->len = end - start;
+  memmove(c->buf, c->buf + start, c->len);
+  if (c->len == SERVE_BUF)
+    c->len = 0;
+  return 0;
+}
+
+void conn_close(int fd) {
+  free(atomic_exchange(&server.conns[fd], NULL));
+  close(fd); // Also leaves the epoll set; the fd number is free again
+}
+
+void *serve_worker(void *arg) {
+  Worker *w = arg;
+  char *out = malloc(SERVE_BUF);
+  struct epoll_event ev[64];
+
+  while (!atomic_load(&server.stop)) {
+    int n = epoll_wait(w->ep, ev, 64, 200);
+    for (int i = 0; i < n; i++) {
+      int fd = ev[i].data.fd;
+      if (serve_conn(w, fd, atomic_load(&server.conns[fd]), out) < 0)
+        conn_close(fd);
+    }
+  }
+  free(out);
+  return NULL;
+}
+
+/*
+ * Rebuilds on SIGHUP or when commands.txt changes. The build runs here, so
+ * neither the acceptor nor the workers stall however long it takes.
+ * wl_open() only maps the index if its SourceStamp matches commands.txt,
+ * so an edited source is always rebuilt from text.
+ */
+void *serve_reloader(void *arg) {
+  (void)arg;
+  struct stat st;
+  SourceStamp last = {0};
+  if (stat(COMMAND_FILE, &st) == 0)
+    last = src_stamp(&st);
+  double next_poll = now_sec() + RELOAD_POLL_MS / 1e3;
+
+  while (!atomic_load(&server.stop)) {
+    nanosleep(&(struct timespec){0, 50000000L}, NULL);
+    int changed = 0;
+    if (now_sec() >= next_poll) {
+      next_poll = now_sec() + RELOAD_POLL_MS / 1e3;
+      SourceStamp now = {0};
+      if (stat(COMMAND_FILE, &st) == 0)
+        now = src_stamp(&st);
+      changed = memcmp(&now, &last, sizeof(now)) != 0;
+    }
+    if (!atomic_exchange(&server.reload, 0) && !changed)
+      continue;
+
+    // Taken before the build, so an edit during it is seen next poll
+    last = (SourceStamp){0};
+    if (stat(COMMAND_FILE, &st) == 0)
+      last = src_stamp(&st);
+    const char *from;
+    double t0 = now_sec();
+    Whitelist *fresh = wl_open(server.index_path, server.perfect, &from);
+    double t_build = now_sec() - t0;
+    rcu_swap(fresh);
+    server.reloads++;
+    printf("Reloaded %u commands from %s: build %.2f ms, grace %.3f ms\n",
+           fresh->bt.count, from, t_build * 1e3,
+           (now_sec() - t0 - t_build) * 1e3);
+    fflush(stdout);
+  }
+  return NULL;
+}
+
+void serve_signal(int sig) {
+  if (sig == SIGHUP)
+    atomic_store(&server.reload, 1);
+  else
+    atomic_store(&server.stop, 1);
+}
+
+int serve(const char *path, int n_workers) {
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (lfd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Cannot create socket %s\n", path);
+    return 1;
+  }
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  unlink(path);
+  if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(lfd, 128) < 0) {
+    perror(path);
+    close(lfd);
+    return 1;
+  }
+
+  struct sigaction sa = {.sa_handler = serve_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+
+  server.n_workers = n_workers;
+  for (int i = 0; i < n_workers; i++) {
+    server.workers[i].ep = epoll_create1(0);
+    pthread_create(&server.workers[i].thread, NULL, serve_worker,
+                   &server.workers[i]);
+  }
+  pthread_t reloader;
+  pthread_create(&reloader, NULL, serve_reloader, NULL);
+  printf("Serving on %s with %d workers (SIGHUP reloads, Ctrl-C stops)\n",
+         path, n_workers);
+  fflush(stdout);
+
+  uint64_t accepted = 0, refused = 0;
+  while (!atomic_load(&server.stop)) {
+    struct pollfd pfd = {.fd = lfd, .events = POLLIN};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int fd = accept(lfd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    if (fd >= MAX_CONNS) {
+      close(fd);
+      refused++;
+      continue;
+    }
+    Conn *c = calloc(1, sizeof(Conn));
+    if (!c) {
+      close(fd);
+      refused++;
+      continue;
+    }
+    atomic_store(&server.conns[fd], c);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    epoll_ctl(server.workers[accepted++ % n_workers].ep, EPOLL_CTL_ADD, fd,
+              &ev);
+  }
+
+  uint64_t served = 0;
+  for (int i = 0; i < n_workers; i++) {
+    pthread_join(server.workers[i].thread, NULL);
+    close(server.workers[i].ep);
+    served += server.workers[i].served;
+  }
+  pthread_join(reloader, NULL);
+  for (int fd = 0; fd < MAX_CONNS; fd++)
+    if (atomic_load(&server.conns[fd]))
+      conn_close(fd);
+  close(lfd);
+  unlink(path);
+  printf("Served %llu requests on %llu connections, %llu reloads, "
+         "%llu refused\n",
+         (unsigned long long)served, (unsigned long long)accepted,
+         (unsigned long long)server.reloads, (unsigned long long)refused);
+  return 0;
+}
+
+// Buffered reader for the load generator's side of a connection.
+typedef struct {
+  int fd;
+  size_t len, pos;
+  char buf[SERVE_BUF];
+} LineReader;
+
+// Next line without the newline, cut to cap - 1 bytes; -1 at end of input.
+int read_line(LineReader *r, char *out, size_t cap) {
+  size_t n = 0;
+  while (1) {
+    if (r->pos == r->len) {
+      ssize_t got = read(r->fd, r->buf, sizeof(r->buf));
+      if (got <= 0)
+        return -1;
+      r->len = got;
+      r->pos = 0;
+    }
+    char c = r->buf[r->pos++];
+    if (c == '\n')
+      break;
+    if (n + 1 < cap)
+      out[n++] = c;
+  }
+  out[n] = '\0';
+  return (int)n;
+}
+
+/*
+ * Load generator for server mode: each client keeps one request in flight
+ * and records its round trip in 1 us buckets. Requests are whitelist
+ * commands, a share of them mistyped or unknown so that every answer path
+ * is exercised.
+ */
+typedef struct {
+  const char *path;
+  const Whitelist *wl;
+  const uint32_t *keys; // Pool offsets
+  uint32_t n_keys;
+  double until;
+  unsigned seed;
+  uint64_t done, errors, answers[3];
+  uint32_t lat[LOAD_LAT_US + 1]; // Last bucket: LOAD_LAT_US and above
+  pthread_t thread;
+} LoadClient;
+
+void *load_client(void *arg) {
+  LoadClient *c = arg;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", c->path);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    c->errors++;
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  LineReader *r = malloc(sizeof(LineReader));
+  r->fd = fd;
+  r->len = r->pos = 0;
+  char cmd[MAX_LEN], req[MAX_LEN + 1], reply[2 * MAX_LEN];
+  while (now_sec() < c->until) {
+    unsigned x = rand_r(&c->seed);
+    if (x % 20 == 0) {
+      snprintf(cmd, sizeof(cmd), "UNKNOWN_%u", x); // Rejected (mostly)
+    } else {
+      snprintf(cmd, sizeof(cmd), "%s",
+               c->wl->pool + c->keys[x / 20 % c->n_keys]);
+      if (x % 20 < 6)
+        mutate(cmd, &c->seed);
+    }
+    int len = snprintf(req, sizeof(req), "%s\n", cmd);
+
+    double t0 = now_sec();
+    if (send_all(fd, req, len) < 0 || read_line(r, reply, sizeof(reply)) < 0) {
+      c->errors++;
+      break;
+    }
+    double us = (now_sec() - t0) * 1e6;
+    c->lat[us < LOAD_LAT_US ? (uint32_t)us : LOAD_LAT_US]++;
+    c->answers[reply[0] == 'A' ? AUTHORIZED
+               : reply[0] == 'S' ? SUGGESTED
+                                 : REJECTED]++;
+    c->done++;
+  }
+  free(r);
+  close(fd);
+  return NULL;
+}
+
+// Smallest latency bucket covering fraction q of the requests.
+uint32_t load_percentile(const uint64_t *lat, uint64_t total, double q) {
+  uint64_t want = (uint64_t)(q * total), seen = 0;
+  for (uint32_t i = 0; i < LOAD_LAT_US; i++)
+    if ((seen += lat[i]) > want)
+      return i + 1;
+  return LOAD_LAT_US;
+}
+
+int run_load(const char *path, int clients, double seconds) {
+  // Sample requests from the same whitelist the server starts from
+  const char *from;
+  Whitelist *wl = wl_open(NULL, 0, &from);
+  uint32_t *keys = malloc((wl->bt.count + 1) * sizeof(uint32_t)), n_keys = 0;
+  for (size_t off = 0; off < wl->pool_len && n_keys < wl->bt.count;
+       off += strlen(wl->pool + off) + 1)
+    keys[n_keys++] = (uint32_t)off;
+  if (n_keys == 0) {
+    printf("No commands to send\n");
+    free(keys);
+    wl_free(wl);
+    free(wl);
+    return 1;
+  }
+
+  LoadClient *c = calloc(clients, sizeof(LoadClient));
+  double t0 = now_sec();
+  for (int i = 0; i < clients; i++) {
+    c[i] = (LoadClient){.path = path, .wl = wl, .keys = keys,
+                        .n_keys = n_keys, .until = t0 + seconds,
+                        .seed = 7 + i};
+    pthread_create(&c[i].thread, NULL, load_client, &c[i]);
+  }
+
+  uint64_t done = 0, errors = 0, answers[3] = {0};
+  uint64_t *lat = calloc(LOAD_LAT_US + 1, sizeof(uint64_t));
+  for (int i = 0; i < clients; i++) {
+    pthread_join(c[i].thread, NULL);
+    done += c[i].done;
+    errors += c[i].errors;
+    for (int a = 0; a < 3; a++)
+      answers[a] += c[i].answers[a];
+    for (int b = 0; b <= LOAD_LAT_US; b++)
+      lat[b] += c[i].lat[b];
+  }
+  double elapsed = now_sec() - t0;
+
+  printf("Load: %d clients, %.1f s, %u commands from %s\n", clients, elapsed,
+         n_keys, from);
+  printf("%llu requests, %.0f req/s, %llu errors\n", (unsigned long long)done,
+         done / elapsed, (unsigned long long)errors);
+  printf("Answers: %llu authorized, %llu suggested, %llu rejected\n",
+         (unsigned long long)answers[AUTHORIZED],
+         (unsigned long long)answers[SUGGESTED],
+         (unsigned long long)answers[REJECTED]);
+  if (done)
+    printf("Latency (us, upper bound): p50 %u, p90 %u, p99 %u, p99.9 %u\n",
+           load_percentile(lat, done, 0.5), load_percentile(lat, done, 0.9),
+           load_percentile(lat, done, 0.99), load_percentile(lat, done, 0.999));
+
+  free(lat);
+  free(c);
+  free(keys);
+  wl_free(wl);
+  free(wl);
+  return errors ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  int perfect = 0;
+  const char *index_path = NULL;
+  long audit_cap = AUDIT_QUEUE;
+  int fsync_ms = 1000;
+  const char *serve_path = NULL, *load_path = NULL;
+  int workers = 4, clients = 4;
+  double seconds = 5;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench") == 0) {
+      run_bench(i + 1 < argc ? atoi(argv[i + 1]) : 20000);
+      return 0;
+    } else if (strcmp(argv[i], "--perfect") == 0)
+      perfect = 1;
+    else if (strcmp(argv[i], "--batch") == 0)
+      suggest_batch = 1;
+    else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+      index_path = argv[++i];
+    else if (strcmp(argv[i], "--audit-queue") == 0 && i + 1 < argc)
+      audit_cap = atol(argv[++i]);
+    else if (strcmp(argv[i], "--fsync") == 0 && i + 1 < argc) {
+      i++;
+      fsync_ms = strcmp(argv[i], "never") == 0   ? -1
+                 : strcmp(argv[i], "batch") == 0 ? 0
+                                                 : atoi(argv[i]);
+    } else if (strcmp(argv[i], "--serve") == 0)
+      serve_path = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i]
+                                                         : SERVE_SOCKET;
+    else if (strcmp(argv[i], "--load") == 0)
+      load_path = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i]
+                                                        : SERVE_SOCKET;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      workers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      clients = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      seconds = atof(argv[++i]);
+    else {
+      printf("Usage: %s [--perfect] [--batch] [--index file]\n"
+             "          [--audit-queue n] [--fsync never|batch|ms]\n"
+             "          [--serve [socket] [-j workers]]\n"
+             "       %s --load [socket] [-c clients] [-t seconds]\n"
+             "       %s --bench [commands]\n",
+             argv[0], argv[0], argv[0]);
+      return 1;
+    }
+  }
+  if (load_path)
+    return run_load(load_path, clients > 0 ? clients : 1, seconds);
+
+  double t0 = now_sec();
+  const char *from;
+  Whitelist *wl = wl_open(index_path, perfect, &from);
+
+  wl_report(wl);
+  printf("Startup from %s: %.2f ms\n", from, (now_sec() - t0) * 1e3);
+  audit_start(audit_cap > 0 ? (uint32_t)audit_cap : 1, fsync_ms);
+
+  if (serve_path) {
+    server.index_path = index_path;
+    server.perfect = perfect;
+    atomic_store(&server.wl, wl);
+    int status = serve(serve_path,
+                       workers < 1             ? 1
+                       : workers > MAX_WORKERS ? MAX_WORKERS
+                                               : workers);
+    audit_stop();
+    wl = atomic_load(&server.wl); // May have been replaced by a reload
+    wl_free(wl);
+    free(wl);
+    return status;
   }
 
   printf(" Command Authorization Simulator \n");
-  printf("Type 'quit' or 'exit' to exit.\n");
+  printf("Type 'quit' or 'exit' to exit, PREFIX* to list commands.\n");
 
   char input[MAX_LEN];
 
@@ -130,24 +2172,35 @@ int main() {
     if (strcmp(input, "quit") == 0 || strcmp(input, "exit") == 0)
       break;
 
-    if (search(root, input)) {
-      printf("[AUTHORIZED] Command executed: %s\n", input);
-    } else {
-      char best[MAX_LEN] = "";
-      int best_dist = INT_MAX;
-
-      find_closest(root, input, best, &best_dist);
+    size_t len = strlen(input);
+    if (len > 0 && input[len - 1] == '*') {
+      long total = 0;
+      if (wl->bt.n_nodes)
+        bt_prefix(&wl->bt, wl->pool, wl->bt.root, input, len - 1, PREFIX_SHOW,
+                  &total);
+      printf("%ld command(s) match", total);
+      if (total > PREFIX_SHOW)
+        printf(" (first %d shown)", PREFIX_SHOW);
+      printf("\n");
+      continue;
+    }
 
-      if (best_dist > 0 && best_dist <= THRESHOLD) {
-        printf("[SUGGESTION] Did you mean: %s ?\n", best);
-      } else {
-        printf("[REJECTED] Command not recognized.\n");
-        log_rejected(input);
-      }
+    char best[MAX_LEN];
+    switch (authorize(wl, input, best)) {
+    case AUTHORIZED:
+      printf("[AUTHORIZED] Command executed: %s\n", input);
+      break;
+    case SUGGESTED:
+      printf("[SUGGESTION] Did you mean: %s ?\n", best);
+      break;
+    default:
+      printf("[REJECTED] Command not recognized.\n");
     }
   }
 
-  free_tree(root);
+  audit_stop();
+  wl_free(wl);
+  free(wl);
   printf("Simulator terminated.\n");
   return 0;
 }
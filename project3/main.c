@@ -1,39 +1,242 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#define MAX_USERS 50 // Max users in the graph
-#define ID_LEN 8 // e.g., "U12345"
+#define ID_LEN 16     // e.g., "U12345"
+#define MATRIX_MAX 16 // Larger graphs print a summary instead
+#define MAX_USERS (1u << 30) // Indices are returned as int
 
+/*
+ * Sparse interaction graph. Every user keeps its out-edges and, as a
+ * reverse index, its in-edges as growable arrays of user indices, so
+ * queries cost O(degree) and memory grows with the number of edges.
+ * Users are found by ID through an open-addressing hash table.
+ */
 typedef struct {
-  char users[MAX_USERS][ID_LEN];
-  int adj[MAX_USERS][MAX_USERS];
-  int count;
+  uint32_t *v;
+  uint32_t n, cap;
+} EdgeList;
+
+typedef struct {
+  char id[ID_LEN];
+  EdgeList out, in;
+} User;
+
+typedef struct {
+  User *users;
+  uint32_t count, cap;
+  uint32_t *slots; // User index + 1; 0 = empty
+  uint32_t mask;
+  uint64_t edges;
 } Graph;
 
 Graph g;
 
+uint64_t hash_id(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return h;
+}
+
 int find_user(const char *id) {
-  for (int i = 0; i < g.count; i++)
-    if (strcmp(g.users[i], id) == 0)
+  if (!g.slots)
+    return -1;
+  for (uint32_t i = hash_id(id) & g.mask;; i = (i + 1) & g.mask) {
+    uint32_t s = g.slots[i];
+    if (!s)
+      return -1;
+    if (strcmp(g.users[s - 1].id, id) == 0)
+      return s - 1;
+  }
+}
+
+// Slot holding user idx; the user must be in the table.
+uint32_t slot_of(uint32_t idx) {
+  uint32_t i = hash_id(g.users[idx].id) & g.mask;
+  while (g.slots[i] != idx + 1)
+    i = (i + 1) & g.mask;
+  return i;
+}
+
+void slot_place(uint32_t idx) {
+  uint32_t i = hash_id(g.users[idx].id) & g.mask;
+  while (g.slots[i])
+    i = (i + 1) & g.mask;
+  g.slots[i] = idx + 1;
+}
+
+// The graph cannot be left half-updated, so running out of memory is fatal.
+void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+// Keeps the table at most half full.
+void slots_reserve(uint32_t n) {
+  if (g.slots && 2 * n <= g.mask + 1)
+    return;
+  uint32_t size = 16;
+  while (size < 2 * n)
+    size *= 2;
+  free(g.slots);
+  g.slots = calloc(size, sizeof(uint32_t));
+  if (!g.slots) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  g.mask = size - 1;
+  for (uint32_t i = 0; i < g.count; i++)
+    slot_place(i);
+}
+
+// Backward-shift deletion: later entries of the probe run move into the gap.
+void slot_remove(uint32_t idx) {
+  uint32_t i = slot_of(idx);
+  for (uint32_t j = (i + 1) & g.mask; g.slots[j]; j = (j + 1) & g.mask) {
+    uint32_t home = hash_id(g.users[g.slots[j] - 1].id) & g.mask;
+    if (((j - home) & g.mask) >= ((j - i) & g.mask)) {
+      g.slots[i] = g.slots[j];
+      i = j;
+    }
+  }
+  g.slots[i] = 0;
+}
+
+void edges_push(EdgeList *e, uint32_t v) {
+  if (e->n == e->cap) {
+    e->cap = e->cap ? e->cap * 2 : 4;
+    e->v = xrealloc(e->v, e->cap * sizeof(uint32_t));
+  }
+  e->v[e->n++] = v;
+}
+
+int edges_find(const EdgeList *e, uint32_t v) {
+  for (uint32_t i = 0; i < e->n; i++)
+    if (e->v[i] == v)
       return i;
   return -1;
 }
 
+// Unordered removal: the last entry fills the gap.
+void edges_drop(EdgeList *e, uint32_t v) {
+  int i = edges_find(e, v);
+  if (i >= 0)
+    e->v[i] = e->v[--e->n];
+}
+
+void edges_relabel(EdgeList *e, uint32_t from, uint32_t to) {
+  int i = edges_find(e, from);
+  if (i >= 0)
+    e->v[i] = to;
+}
+
+// Returns the new user's index, -1 if the ID is taken, -2 if the graph is full.
+int user_insert(const char *id) {
+  if (find_user(id) != -1)
+    return -1;
+  if (g.count == MAX_USERS)
+    return -2;
+  if (g.count == g.cap) {
+    g.cap = g.cap ? g.cap * 2 : 64;
+    g.users = xrealloc(g.users, (size_t)g.cap * sizeof(User));
+  }
+  slots_reserve(g.count + 1);
+  User *u = &g.users[g.count];
+  memset(u, 0, sizeof(*u));
+  snprintf(u->id, ID_LEN, "%s", id);
+  slot_place(g.count);
+  return g.count++;
+}
+
+/*
+ * Drops the user's edges from its neighbours' lists, then moves the last
+ * user into the freed index so indices stay dense. Only the moved user's
+ * neighbours need relabelling.
+ */
+void user_delete(uint32_t idx) {
+  User *u = &g.users[idx];
+  for (uint32_t i = 0; i < u->out.n; i++)
+    edges_drop(&g.users[u->out.v[i]].in, idx);
+  for (uint32_t i = 0; i < u->in.n; i++)
+    edges_drop(&g.users[u->in.v[i]].out, idx);
+  g.edges -= u->out.n + u->in.n;
+  free(u->out.v);
+  free(u->in.v);
+  slot_remove(idx);
+
+  uint32_t last = --g.count;
+  if (idx == last)
+    return;
+  g.slots[slot_of(last)] = idx + 1;
+  g.users[idx] = g.users[last];
+  User *m = &g.users[idx];
+  for (uint32_t i = 0; i < m->out.n; i++)
+    edges_relabel(&g.users[m->out.v[i]].in, last, idx);
+  for (uint32_t i = 0; i < m->in.n; i++)
+    edges_relabel(&g.users[m->in.v[i]].out, last, idx);
+}
+
+// Returns 1 if the edge was added, 0 if it already existed.
+int edge_insert(uint32_t f, uint32_t t) {
+  if (edges_find(&g.users[f].out, t) >= 0)
+    return 0;
+  edges_push(&g.users[f].out, t);
+  edges_push(&g.users[t].in, f);
+  g.edges++;
+  return 1;
+}
+
+// Returns 1 if the edge was removed, 0 if there was none.
+int edge_delete(uint32_t f, uint32_t t) {
+  if (edges_find(&g.users[f].out, t) < 0)
+    return 0;
+  edges_drop(&g.users[f].out, t);
+  edges_drop(&g.users[t].in, f);
+  g.edges--;
+  return 1;
+}
+
+void graph_free() {
+  for (uint32_t i = 0; i < g.count; i++) {
+    free(g.users[i].out.v);
+    free(g.users[i].in.v);
+  }
+  free(g.users);
+  free(g.slots);
+  memset(&g, 0, sizeof(g));
+}
+
+size_t graph_bytes() {
+  size_t bytes = g.cap * sizeof(User) + (g.slots ? ((size_t)g.mask + 1) * 4 : 0);
+  for (uint32_t i = 0; i < g.count; i++)
+    bytes += (g.users[i].out.cap + g.users[i].in.cap) * sizeof(uint32_t);
+  return bytes;
+}
+
 int add_user(const char *id) {
-  if (g.count >= MAX_USERS) {
-    printf("User limit reached.\n");
+  if (strlen(id) >= ID_LEN) {
+    printf("User ID too long.\n");
     return -1;
   }
-  if (find_user(id) != -1) {
+  int idx = user_insert(id);
+  if (idx == -1) {
     printf("User already exists.\n");
     return -1;
   }
-  strcpy(g.users[g.count], id);
-  g.count++;
+  if (idx == -2) {
+    printf("User limit reached.\n");
+    return -1;
+  }
 
   printf("User %s added.\n", id);
-  return g.count - 1;
+  return idx;
 }
 
 int ensure_user(const char *id) {
@@ -50,17 +253,7 @@ void remove_user(const char *id) {
     return;
   }
 
-  for (int i = idx; i < g.count - 1; i++) {
-    strcpy(g.users[i], g.users[i + 1]);
-    for (int j = 0; j < g.count; j++)
-      g.adj[i][j] = g.adj[i + 1][j];
-  }
-
-  for (int i = 0; i < g.count - 1; i++)
-    for (int j = idx; j < g.count - 1; j++)
-      g.adj[i][j] = g.adj[i][j + 1];
-
-  g.count--;
+  user_delete(idx);
   printf("User %s removed.\n", id);
 }
 
@@ -70,8 +263,10 @@ void add_interaction(const char *from, const char *to) {
   if (f == -1 || t == -1 || f == t)
     return;
 
-  g.adj[f][t] = 1;
-  printf("Interaction %s -> %s added.\n", from, to);
+  if (edge_insert(f, t))
+    printf("Interaction %s -> %s added.\n", from, to);
+  else
+    printf("Interaction %s -> %s already exists.\n", from, to);
 }
 
 void remove_interaction(const char *from, const char *to) {
@@ -81,8 +276,10 @@ void remove_interaction(const char *from, const char *to) {
     printf("User not found.\n");
     return;
   }
-  g.adj[f][t] = 0;
-  printf("Interaction %s -> %s removed.\n", from, to);
+  if (edge_delete(f, t))
+    printf("Interaction %s -> %s removed.\n", from, to);
+  else
+    printf("No interaction %s -> %s.\n", from, to);
 }
 
 void query_user(const char *id) {
@@ -92,26 +289,19 @@ void query_user(const char *id) {
     return;
   }
 
+  const User *u = &g.users[idx];
   printf("\nUser %s\n", id);
 
   printf("Outgoing:\n");
-  int found = 0;
-  for (int j = 0; j < g.count; j++)
-    if (g.adj[idx][j]) {
-      printf("  -> %s\n", g.users[j]);
-      found = 1;
-    }
-  if (!found)
+  for (uint32_t i = 0; i < u->out.n; i++)
+    printf("  -> %s\n", g.users[u->out.v[i]].id);
+  if (!u->out.n)
     printf("  None\n");
 
   printf("Incoming:\n");
-  found = 0;
-  for (int i = 0; i < g.count; i++)
-    if (g.adj[i][idx]) {
-      printf("  <- %s\n", g.users[i]);
-      found = 1;
-    }
-  if (!found)
+  for (uint32_t i = 0; i < u->in.n; i++)
+    printf("  <- %s\n", g.users[u->in.v[i]].id);
+  if (!u->in.n)
     printf("  None\n");
 }
 
@@ -120,16 +310,24 @@ void print_matrix() {
     printf("Graph empty.\n");
     return;
   }
+  if (g.count > MATRIX_MAX) {
+    printf("\n%u users, %llu interactions (matrix shown up to %d users)\n",
+           g.count, (unsigned long long)g.edges, MATRIX_MAX);
+    return;
+  }
 
   printf("\nAdjacency Matrix:\n    ");
-  for (int i = 0; i < g.count; i++)
-    printf("%7s", g.users[i]);
+  for (uint32_t i = 0; i < g.count; i++)
+    printf("%7s", g.users[i].id);
   printf("\n");
 
-  for (int i = 0; i < g.count; i++) {
-    printf("%4s", g.users[i]);
-    for (int j = 0; j < g.count; j++)
-      printf("%7d", g.adj[i][j]);
+  for (uint32_t i = 0; i < g.count; i++) {
+    int row[MATRIX_MAX] = {0};
+    for (uint32_t k = 0; k < g.users[i].out.n; k++)
+      row[g.users[i].out.v[k]] = 1;
+    printf("%4s", g.users[i].id);
+    for (uint32_t j = 0; j < g.count; j++)
+      printf("%7d", row[j]);
     printf("\n");
   }
 }
@@ -144,8 +342,112 @@ void load_initial() {
     add_interaction(edges[i][0], edges[i][1]);
 }
 
-int main() {
-  memset(&g, 0, sizeof(g));
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Every out-edge must appear once in its target's in-list and vice versa.
+int graph_check() {
+  uint64_t out = 0, in = 0;
+  for (uint32_t i = 0; i < g.count; i++) {
+    const User *u = &g.users[i];
+    if (find_user(u->id) != (int)i)
+      return 0;
+    for (uint32_t k = 0; k < u->out.n; k++)
+      if (u->out.v[k] >= g.count ||
+          edges_find(&g.users[u->out.v[k]].in, i) < 0)
+        return 0;
+    out += u->out.n;
+    in += u->in.n;
+  }
+  return out == g.edges && in == g.edges;
+}
+
+// Synthetic graph with an average out-degree of DEGREE.
+void run_bench(uint32_t n) {
+  enum { DEGREE = 20, QUERIES = 1000000 };
+  char id[ID_LEN];
+  unsigned seed = 7;
+
+  double t0 = now_sec();
+  for (uint32_t i = 0; i < n; i++) {
+    snprintf(id, sizeof(id), "U%u", 100000 + i);
+    user_insert(id);
+  }
+  double t_users = now_sec() - t0;
+
+  t0 = now_sec();
+  for (uint32_t f = 0; f < n; f++)
+    for (int k = 0; k < DEGREE; k++) {
+      uint32_t t = rand_r(&seed) % n;
+      if (t != f)
+        edge_insert(f, t);
+    }
+  double t_edges = now_sec() - t0;
+  uint64_t edges = g.edges;
+  size_t bytes = graph_bytes();
+
+  // Lookup by ID, then walk both lists
+  uint64_t seen = 0;
+  t0 = now_sec();
+  for (int q = 0; q < QUERIES; q++) {
+    snprintf(id, sizeof(id), "U%u", 100000 + rand_r(&seed) % n);
+    const User *u = &g.users[find_user(id)];
+    for (uint32_t i = 0; i < u->out.n; i++)
+      seen += u->out.v[i];
+    for (uint32_t i = 0; i < u->in.n; i++)
+      seen += u->in.v[i];
+  }
+  double t_query = now_sec() - t0;
+
+  uint32_t drops = n / 10, removed = 0;
+  t0 = now_sec();
+  for (uint32_t k = 0; k < drops; k++) {
+    uint32_t f = rand_r(&seed) % g.count;
+    if (g.users[f].out.n)
+      removed += edge_delete(f, g.users[f].out.v[rand_r(&seed) %
+                                                 g.users[f].out.n]);
+  }
+  double t_drop = now_sec() - t0;
+
+  uint32_t gone = n / 100;
+  t0 = now_sec();
+  for (uint32_t k = 0; k < gone; k++)
+    user_delete(rand_r(&seed) % g.count);
+  double t_gone = now_sec() - t0;
+
+  printf("Users: %u, edges: %llu, %.1f MiB (%.1f bytes/edge)\n", n,
+         (unsigned long long)edges, bytes / 1048576.0,
+         edges ? (double)bytes / edges : 0.0);
+  printf("Insert: users %.0f ns, edges %.0f ns\n", t_users * 1e9 / n,
+         edges ? t_edges * 1e9 / edges : 0.0);
+  printf("Query:  %.0f ns (ID lookup + in/out lists, checksum %llu)\n",
+         t_query * 1e9 / QUERIES, (unsigned long long)seen % 1000);
+  printf("Delete: %u edges at %.0f ns, %u users at %.1f us\n", removed,
+         t_drop * 1e9 / (drops ? drops : 1), gone,
+         t_gone * 1e6 / (gone ? gone : 1));
+  printf("Consistency: %s\n", graph_check() ? "ok" : "BROKEN");
+  graph_free();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    // IDs are "U" + (100000 + i), which fits a u32 up to MAX_USERS
+    unsigned long long n = 1000000;
+    char *end = NULL;
+    if (argc > 2)
+      n = strtoull(argv[2], &end, 10);
+    if (argc > 2 && (end == argv[2] || *end || argv[2][0] == '-'))
+      n = 0;
+    if (n < 2 || n > MAX_USERS) {
+      printf("--bench takes 2..%u users\n", MAX_USERS);
+      return 1;
+    }
+    run_bench((uint32_t)n);
+    return 0;
+  }
 
   printf("Interaction Mapping Tool \n");
   load_initial();
@@ -202,10 +504,12 @@ int main() {
       break;
     case '0':
       printf("Exiting.\n");
+      graph_free();
       return 0;
     default:
       printf("Invalid choice.\n");
     }
   }
+  graph_free();
   return 0;
 }
@@ -0,0 +1,105 @@
+#!/usr/bin/env bash
+# Compression benchmark for project5.
+#
+# Builds both programs, generates a synthetic corpus and runs compress +
+# decompress over every input in single-stream, 4-lane interleaved (-4) and
+# container mode, so the decode side of each payload layout is measured
+# too. Every run is gated on a byte-for-byte round-trip check; any mismatch
+# aborts.
+#
+# Usage: ./bench.sh
+#   SIZE_MB=64     size of the skewed-text, random and single-symbol inputs
+#   BIG_MB=2048    size of the large input (0 skips it)
+#   THREADS=N      container-mode threads (default: all cores)
+#   WORK=dir       scratch directory (default: a fresh mktemp dir)
+
+set -euo pipefail
+
+SIZE_MB=${SIZE_MB:-64}
+BIG_MB=${BIG_MB:-2048}
+THREADS=${THREADS:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+SRC=$(cd "$(dirname "$0")" && pwd)
+WORK=${WORK:-$(mktemp -d)}
+mkdir -p "$WORK"
+
+CC=${CC:-cc}
+$CC -O2 -pthread -o "$WORK/main_compress" "$SRC/main_compress.c"
+$CC -O2 -pthread -o "$WORK/main_decompress" "$SRC/main_decompress.c"
+
+# Prints the number after "<label>:" in a program's stats output.
+# Prints "-" when the mode does not report that field.
+field() {
+  awk -F': *' -v key="$1" '
+    index($0, key) == 1 { print $2 + 0; found = 1; exit }
+    END { if (!found) print "-" }' "$2"
+}
+
+make_corpus() {
+  local bytes=$((SIZE_MB * 1024 * 1024))
+
+  # Skewed text: gateway-style log lines
+  awk -v n="$bytes" 'BEGIN {
+    srand(7); split("INFO WARN ERROR DEBUG", lv, " "); out = 0
+    while (out < n) {
+      line = sprintf("2026-10-%02d 12:%02d:%02d [%s] meter=%04d power=%.2fkW voltage=%dV",
+                     int(rand() * 28) + 1, int(rand() * 60), int(rand() * 60),
+                     lv[int(rand() * 4) + 1], 1000 + int(rand() * 9000),
+                     rand() * 10, 220 + int(rand() * 21))
+      line = line "\n"
+      if (out + length(line) > n) line = substr(line, 1, n - out)
+      printf "%s", line; out += length(line)
+    }
+  }' > "$WORK/skewed.txt"
+
+  head -c "$bytes" /dev/urandom > "$WORK/random.bin"
+  head -c "$bytes" /dev/zero | tr '\0' 'a' > "$WORK/single.txt"
+
+  if [ "$BIG_MB" -gt 0 ]; then
+    : > "$WORK/large.txt"
+    while [ "$(wc -c < "$WORK/large.txt")" -lt $((BIG_MB * 1024 * 1024)) ]; do
+      cat "$WORK/skewed.txt" >> "$WORK/large.txt"
+    done
+  fi
+}
+
+run() {
+  local input=$1 mode=$2
+  local comp="$WORK/out.hz" dec="$WORK/out.dec"
+  local clog="$WORK/comp.log" dlog="$WORK/dec.log"
+  local cflags=()
+  [ "$mode" = container ] && cflags=(-j "$THREADS")
+  [ "$mode" = lanes4 ] && cflags=(-4)
+
+  "$WORK/main_compress" "${cflags[@]}" -o "$comp" "$input" > "$clog"
+  "$WORK/main_decompress" -j "$THREADS" -o "$dec" "$comp" > "$dlog"
+
+  if ! cmp -s "$input" "$dec"; then
+    echo "FAIL: round trip mismatch for $(basename "$input") ($mode)" >&2
+    exit 1
+  fi
+
+  local orig comp_size
+  orig=$(wc -c < "$input")
+  comp_size=$(wc -c < "$comp")
+  printf "%-12s %-9s %8.1f %7.3f %9.1f %9.1f %8s %8s %8s %9s %9s\n" \
+    "$(basename "$input")" "$mode" "$(awk "BEGIN { print $orig / 1048576 }")" \
+    "$(awk "BEGIN { print $comp_size / $orig }")" \
+    "$(field 'Throughput' "$clog")" "$(field 'Throughput' "$dlog")" \
+    "$(field 'Table build time' "$clog")" "$(field 'Encode time' "$clog")" \
+    "$(field 'Decode time' "$dlog")" \
+    "$(field 'Peak RSS' "$clog")" "$(field 'Peak RSS' "$dlog")"
+  rm -f "$comp" "$dec"
+}
+
+make_corpus
+
+printf "%-12s %-9s %8s %7s %9s %9s %8s %8s %8s %9s %9s\n" \
+  input mode MiB ratio comp_MB/s dec_MB/s table_s encode_s decode_s \
+  comp_KiB dec_KiB
+for f in skewed.txt random.bin single.txt large.txt; do
+  [ -f "$WORK/$f" ] || continue
+  run "$WORK/$f" single
+  run "$WORK/$f" lanes4
+  run "$WORK/$f" container
+done
+echo "All round trips verified. Scratch files in $WORK"
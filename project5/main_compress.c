@@ -1,6 +1,28 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IO_BUF_SIZE (1 << 20)          // 1 MiB read/write blocks
+#define MAX_CODE_LEN 15                // Longest code, fits in a nibble
+#define MAX_HEADER_BYTES (4 + 1 + 128) // magic + last symbol + nibbles
+#define PAYLOAD_MAGIC "HZC1"
+#define PAYLOAD_X4_MAGIC "HZC4"
+#define LANES 4                        // Bitstreams in an interleaved payload
+#define CONTAINER_MAGIC "HZB2"
+#define STREAM_MAGIC "HZS1"
+#define DEFAULT_BLOCK_SIZE (1 << 20)   // Container block size (1 MiB)
+#define DEFAULT_SEEK_INTERVAL (1 << 16) // Raw bytes between seek marks
+#define MAX_KIB (UINT32_MAX / 1024)     // Largest -b / -s value
+#define BATCH_SUFFIX ".hz"             // Appended to batch output names
 
 typedef struct HNode {
   unsigned char symbol;
@@ -20,7 +42,21 @@ typedef struct {
   int len;
 } Code;
 
-Code codes[256];
+double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kib(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+  return ru.ru_maxrss;
+#endif
+}
 
 MinHeap *heap_new(int capacity) {
   MinHeap *h = malloc(sizeof(MinHeap));
@@ -87,96 +123,146 @@ void free_tree(HNode *root) {
   free(root);
 }
 
-void build_codes(HNode *node, uint32_t bits, int len) {
+/*
+ * Byte histogram spread over four sub-tables, so runs of the same byte
+ * do not serialize on a single counter, with one 8-byte load per eight
+ * input bytes. Adds into freq.
+ */
+void count_freq(const uint8_t *in, size_t n, uint64_t freq[256]) {
+  static const size_t chunk = (size_t)1 << 30; // Keeps sub-counts in 32 bits
+  uint32_t t[4][256];
+
+  for (size_t base = 0; base < n; base += chunk) {
+    size_t end = (n - base < chunk) ? n : base + chunk;
+    memset(t, 0, sizeof(t));
+
+    size_t i = base;
+    for (; i + 8 <= end; i += 8) {
+      uint64_t w;
+      memcpy(&w, in + i, 8);
+      t[0][(uint8_t)w]++;
+      t[1][(uint8_t)(w >> 8)]++;
+      t[2][(uint8_t)(w >> 16)]++;
+      t[3][(uint8_t)(w >> 24)]++;
+      t[0][(uint8_t)(w >> 32)]++;
+      t[1][(uint8_t)(w >> 40)]++;
+      t[2][(uint8_t)(w >> 48)]++;
+      t[3][(uint8_t)(w >> 56)]++;
+    }
+    for (; i < end; i++)
+      t[0][in[i]]++;
+
+    for (int s = 0; s < 256; s++)
+      freq[s] += (uint64_t)t[0][s] + t[1][s] + t[2][s] + t[3][s];
+  }
+}
+
+void code_lengths(HNode *node, int len, uint8_t *lens) {
   if (!node->left && !node->right) {
-    codes[node->symbol].bits = bits;
-    codes[node->symbol].len = (len > 0) ? len : 1;
+    lens[node->symbol] = (len > 0) ? len : 1;
     return;
   }
   if (node->left)
-    build_codes(node->left, bits << 1, len + 1);
+    code_lengths(node->left, len + 1, lens);
   if (node->right)
-    build_codes(node->right, (bits << 1) | 1, len + 1);
+    code_lengths(node->right, len + 1, lens);
 }
 
+/*
+ * Package-merge: optimal code lengths with none longer than max_len.
+ * Each round pairs up the cheapest items of the previous list into
+ * packages and merges them back with the leaves; a symbol's length is the
+ * number of times it appears in the first 2n - 2 items of the final list.
+ */
 typedef struct {
-  FILE *f;
-  uint8_t buf;
-  int bit_pos;
-} BitWriter;
+  uint64_t weight;
+  int symbol; // -1 for packages
+  int left, right;
+} PMItem;
 
-void bw_init(BitWriter *bw, FILE *f) {
-  bw->f = f;
-  bw->buf = 0;
-  bw->bit_pos = 0;
-}
-
-void bw_write_bit(BitWriter *bw, int bit) {
-  bw->buf = (bw->buf << 1) | (bit & 1);
-  bw->bit_pos++;
-  if (bw->bit_pos == 8) {
-    fputc(bw->buf, bw->f);
-    bw->buf = 0;
-    bw->bit_pos = 0;
+void count_leaves(PMItem *pool, int i, uint8_t *lens) {
+  if (pool[i].symbol >= 0) {
+    lens[pool[i].symbol]++;
+    return;
   }
+  count_leaves(pool, pool[i].left, lens);
+  count_leaves(pool, pool[i].right, lens);
 }
 
-int bw_flush(BitWriter *bw) {
-  if (bw->bit_pos > 0) {
-    bw->buf <<= (8 - bw->bit_pos);
-    fputc(bw->buf, bw->f);
-    return bw->bit_pos;
+void limit_lengths(uint64_t freq[256], uint8_t *lens, int max_len) {
+  PMItem *pool = malloc(sizeof(PMItem) * 256 * (max_len + 1));
+  int n = 0;
+
+  // Leaves sorted by weight (insertion sort, n <= 256)
+  for (int s = 0; s < 256; s++) {
+    if (!freq[s])
+      continue;
+    int i = n++;
+    while (i > 0 && pool[i - 1].weight > freq[s]) {
+      pool[i] = pool[i - 1];
+      i--;
+    }
+    pool[i].weight = freq[s];
+    pool[i].symbol = s;
+    pool[i].left = pool[i].right = -1;
   }
-  return 8;
-}
 
-void write_table(FILE *f, uint64_t freq[256]) {
-  uint32_t count = 0;
-  for (int i = 0; i < 256; i++)
-    if (freq[i])
-      count++;
-  fwrite(&count, sizeof(uint32_t), 1, f);
+  int list[512], next[512];
+  int list_len = n, used = n;
+  for (int i = 0; i < n; i++)
+    list[i] = i;
 
-  for (int i = 0; i < 256; i++) {
-    if (!freq[i])
-      continue;
-    uint8_t sym = i;
-    uint8_t len = codes[i].len;
-    fwrite(&sym, 1, 1, f);
-    fwrite(&len, 1, 1, f);
+  for (int level = 1; level < max_len; level++) {
+    int np = list_len / 2;
+    int first_pkg = used;
+    for (int i = 0; i < np; i++) {
+      PMItem *pk = &pool[used++];
+      pk->weight = pool[list[2 * i]].weight + pool[list[2 * i + 1]].weight;
+      pk->symbol = -1;
+      pk->left = list[2 * i];
+      pk->right = list[2 * i + 1];
+    }
 
-    uint8_t cbytes[4] = {0};
-    int nbytes = (len + 7) / 8;
-    for (int b = 0; b < len; b++)
-      if ((codes[i].bits >> (len - 1 - b)) & 1)
-        cbytes[b / 8] |= (1 << (7 - b % 8));
-    fwrite(cbytes, 1, nbytes, f);
+    int li = 0, pi = 0, k = 0;
+    while (li < n || pi < np) {
+      if (pi == np ||
+          (li < n && pool[li].weight <= pool[first_pkg + pi].weight))
+        next[k++] = li++;
+      else
+        next[k++] = first_pkg + pi++;
+    }
+    memcpy(list, next, sizeof(int) * k);
+    list_len = k;
   }
+
+  for (int s = 0; s < 256; s++)
+    lens[s] = 0;
+  for (int i = 0; i < 2 * n - 2; i++)
+    count_leaves(pool, list[i], lens);
+  free(pool);
 }
 
-int compress_file(const char *input, const char *output) {
-  FILE *fin = fopen(input, "rb");
-  if (!fin) {
-    perror("Cannot open input");
-    return -1;
-  }
+// Canonical codes: shorter codes first, ties broken by symbol value.
+void assign_canonical(uint8_t *lens, Code *codes) {
+  int bl_count[MAX_CODE_LEN + 1] = {0};
+  uint32_t next_code[MAX_CODE_LEN + 1] = {0};
+  for (int s = 0; s < 256; s++)
+    bl_count[lens[s]]++;
+  bl_count[0] = 0;
 
-  uint64_t freq[256] = {0};
-  int ch;
-  uint64_t orig_size = 0;
-  while ((ch = fgetc(fin)) != EOF) {
-    freq[ch]++;
-    orig_size++;
+  uint32_t code = 0;
+  for (int len = 1; len <= MAX_CODE_LEN; len++) {
+    code = (code + bl_count[len - 1]) << 1;
+    next_code[len] = code;
   }
 
-  if (orig_size == 0) {
-    fclose(fin);
-    printf("Input file is empty.\n");
-    return -1;
+  for (int s = 0; s < 256; s++) {
+    codes[s].len = lens[s];
+    codes[s].bits = lens[s] ? next_code[lens[s]]++ : 0;
   }
+}
 
-  rewind(fin);
-
+void build_code_table(uint64_t freq[256], Code *codes) {
   MinHeap *heap = heap_new(256);
   for (int i = 0; i < 256; i++)
     if (freq[i])
@@ -197,58 +283,1010 @@ int compress_file(const char *input, const char *output) {
   free(heap->data);
   free(heap);
 
+  uint8_t lens[256] = {0};
+  code_lengths(root, 0, lens);
+  free_tree(root);
+
+  int max_len = 0;
   for (int i = 0; i < 256; i++)
-    codes[i].bits = 0, codes[i].len = 0;
-  build_codes(root, 0, 0);
+    if (lens[i] > max_len)
+      max_len = lens[i];
+  if (max_len > MAX_CODE_LEN)
+    limit_lengths(freq, lens, MAX_CODE_LEN);
+
+  assign_canonical(lens, codes);
+}
+
+typedef struct {
+  FILE *f;      // NULL = keep everything in buf, growing as needed
+  uint64_t acc; // Pending bits, right-aligned
+  int nbits;    // Number of pending bits in acc (< 32 between writes)
+  uint8_t *buf; // Output block, written with one fwrite when full
+  size_t len;
+  size_t cap;
+} BitWriter;
+
+void bw_init(BitWriter *bw, FILE *f) {
+  bw->f = f;
+  bw->acc = 0;
+  bw->nbits = 0;
+  bw->buf = malloc(IO_BUF_SIZE);
+  bw->len = 0;
+  bw->cap = IO_BUF_SIZE;
+}
+
+void bw_spill(BitWriter *bw) {
+  if (bw->f) {
+    fwrite(bw->buf, 1, bw->len, bw->f);
+    bw->len = 0;
+  } else {
+    bw->cap *= 2;
+    bw->buf = realloc(bw->buf, bw->cap);
+  }
+}
+
+void bw_write_code(BitWriter *bw, Code cd) {
+  bw->acc = (bw->acc << cd.len) | cd.bits;
+  bw->nbits += cd.len;
+  if (bw->nbits >= 32) {
+    bw->nbits -= 32;
+    uint32_t word = (uint32_t)(bw->acc >> bw->nbits);
+    uint8_t *p = bw->buf + bw->len;
+    p[0] = word >> 24;
+    p[1] = word >> 16;
+    p[2] = word >> 8;
+    p[3] = word;
+    bw->len += 4;
+    if (bw->len > bw->cap - 8)
+      bw_spill(bw);
+  }
+}
+
+// Pads the final byte and returns its number of valid bits. In-memory
+// writers keep their buffer for the caller.
+int bw_flush(BitWriter *bw) {
+  int last_valid = 8;
+  while (bw->nbits >= 8) {
+    bw->nbits -= 8;
+    bw->buf[bw->len++] = (uint8_t)(bw->acc >> bw->nbits);
+  }
+  if (bw->nbits > 0) {
+    bw->buf[bw->len++] = (uint8_t)(bw->acc << (8 - bw->nbits));
+    last_valid = bw->nbits;
+  }
+  bw->nbits = 0;
+  if (bw->f) {
+    fwrite(bw->buf, 1, bw->len, bw->f);
+    free(bw->buf);
+    bw->buf = NULL;
+    bw->len = 0;
+  }
+  return last_valid;
+}
+
+/*
+ * Payload header: "HZC1" | u8 last symbol | code lengths as nibbles for
+ * symbols 0..last (high nibble first) | u64 orig_size | u8 last_valid.
+ * Codes are canonical, so the lengths alone rebuild the table.
+ */
+size_t pack_header(uint8_t *dst, Code *codes, const char *magic) {
+  int last = 0;
+  for (int s = 0; s < 256; s++)
+    if (codes[s].len)
+      last = s;
+
+  memcpy(dst, magic, 4);
+  dst[4] = (uint8_t)last;
+  size_t pos = 5;
+  for (int s = 0; s <= last; s += 2) {
+    uint8_t hi = codes[s].len;
+    uint8_t lo = (s + 1 <= last) ? codes[s + 1].len : 0;
+    dst[pos++] = (uint8_t)(hi << 4 | lo);
+  }
+  return pos;
+}
+
+/*
+ * Encodes one block in the single-stream format (header, original size,
+ * valid bits of the last byte, bitstream) into a malloc'd buffer. When
+ * marks is given, marks[k] receives the bitstream offset of raw byte
+ * (k + 1) * interval.
+ */
+uint8_t *encode_block(const uint8_t *in, size_t n, size_t *out_len,
+                      uint64_t *marks, uint32_t interval) {
+  uint64_t freq[256] = {0};
+  count_freq(in, n, freq);
+
+  Code codes[256];
+  build_code_table(freq, codes);
+
+  BitWriter bw;
+  bw_init(&bw, NULL);
+  bw.len = pack_header(bw.buf, codes, PAYLOAD_MAGIC);
+
+  uint64_t orig_size = n;
+  memcpy(bw.buf + bw.len, &orig_size, sizeof(uint64_t));
+  bw.len += sizeof(uint64_t);
+  size_t valid_pos = bw.len++;
+  size_t data_pos = bw.len;
+
+  size_t step = marks ? interval : n;
+  for (size_t start = 0, k = 0; start < n; start += step) {
+    if (start > 0)
+      marks[k++] = (uint64_t)(bw.len - data_pos) * 8 + bw.nbits;
+    size_t end = (n - start < step) ? n : start + step;
+    for (size_t i = start; i < end; i++)
+      bw_write_code(&bw, codes[in[i]]);
+  }
+
+  bw.buf[valid_pos] = (uint8_t)bw_flush(&bw);
+
+  *out_len = bw.len;
+  return bw.buf;
+}
+
+/*
+ * Interleaved payload: byte i is coded into bitstream i % LANES, so a
+ * decoder can run the lanes as independent dependency chains. Returns
+ * NULL if a lane would not fit its u32 size field.
+ *   "HZC4" | u8 last symbol | nibbles | u64 orig_size
+ *   LANES x u32 stream bytes | LANES x u8 last_valid | streams
+ */
+uint8_t *encode_block_x4(const uint8_t *in, size_t n, size_t *out_len) {
+  uint64_t freq[256] = {0};
+  count_freq(in, n, freq);
+
+  Code codes[256];
+  build_code_table(freq, codes);
+
+  BitWriter bw[LANES];
+  for (int l = 0; l < LANES; l++)
+    bw_init(&bw[l], NULL);
+
+  size_t i = 0;
+  for (; i + LANES <= n; i += LANES) {
+    bw_write_code(&bw[0], codes[in[i]]);
+    bw_write_code(&bw[1], codes[in[i + 1]]);
+    bw_write_code(&bw[2], codes[in[i + 2]]);
+    bw_write_code(&bw[3], codes[in[i + 3]]);
+  }
+  for (; i < n; i++)
+    bw_write_code(&bw[i % LANES], codes[in[i]]);
+
+  uint32_t sizes[LANES];
+  uint8_t last_valid[LANES];
+  size_t total = 0;
+  int too_big = 0;
+  for (int l = 0; l < LANES; l++) {
+    last_valid[l] = (uint8_t)bw_flush(&bw[l]);
+    sizes[l] = (uint32_t)bw[l].len;
+    total += bw[l].len;
+    too_big |= bw[l].len > UINT32_MAX;
+  }
+  if (too_big) {
+    // Lane sizes are stored as u32; use -b to split larger inputs
+    printf("Input too large for one interleaved payload (lane over 4 GiB).\n");
+    for (int l = 0; l < LANES; l++)
+      free(bw[l].buf);
+    return NULL;
+  }
+
+  uint8_t *out = malloc(MAX_HEADER_BYTES + sizeof(uint64_t) + sizeof(sizes) +
+                        sizeof(last_valid) + total);
+  size_t pos = pack_header(out, codes, PAYLOAD_X4_MAGIC);
+  uint64_t orig_size = n;
+  memcpy(out + pos, &orig_size, sizeof(uint64_t));
+  pos += sizeof(uint64_t);
+  memcpy(out + pos, sizes, sizeof(sizes));
+  pos += sizeof(sizes);
+  memcpy(out + pos, last_valid, sizeof(last_valid));
+  pos += sizeof(last_valid);
+  for (int l = 0; l < LANES; l++) {
+    memcpy(out + pos, bw[l].buf, bw[l].len);
+    pos += bw[l].len;
+    free(bw[l].buf);
+  }
+
+  *out_len = pos;
+  return out;
+}
+
+int compress_file(const char *input, const char *output) {
+  FILE *fin = fopen(input, "rb");
+  if (!fin) {
+    perror("Cannot open input");
+    return -1;
+  }
+
+  double t0 = now_sec();
+  uint8_t *in = malloc(IO_BUF_SIZE);
+  uint64_t freq[256] = {0};
+  uint64_t orig_size = 0;
+  size_t n;
+  while ((n = fread(in, 1, IO_BUF_SIZE, fin)) > 0) {
+    count_freq(in, n, freq);
+    orig_size += n;
+  }
+  double t1 = now_sec();
+
+  if (orig_size == 0) {
+    free(in);
+    fclose(fin);
+    printf("Input file is empty.\n");
+    return -1;
+  }
+
+  rewind(fin);
+
+  Code codes[256];
+  build_code_table(freq, codes);
+  double t2 = now_sec();
 
   FILE *fout = fopen(output, "wb");
   if (!fout) {
     perror("Cannot open output");
-    free_tree(root);
+    free(in);
     fclose(fin);
     return -1;
   }
 
-  write_table(fout, freq);
+  uint8_t header[MAX_HEADER_BYTES];
+  fwrite(header, 1, pack_header(header, codes, PAYLOAD_MAGIC), fout);
   fwrite(&orig_size, sizeof(uint64_t), 1, fout);
 
   long valid_pos = ftell(fout);
-  uint32_t placeholder = 0;
-  fwrite(&placeholder, sizeof(uint32_t), 1, fout);
+  fputc(0, fout);
 
   BitWriter bw;
   bw_init(&bw, fout);
 
-  while ((ch = fgetc(fin)) != EOF) {
-    Code cd = codes[ch];
-    for (int b = cd.len - 1; b >= 0; b--)
-      bw_write_bit(&bw, (cd.bits >> b) & 1);
-  }
+  while ((n = fread(in, 1, IO_BUF_SIZE, fin)) > 0)
+    for (size_t i = 0; i < n; i++)
+      bw_write_code(&bw, codes[in[i]]);
 
   int last_valid = bw_flush(&bw);
 
+  fseek(fout, 0, SEEK_END);
+  long comp_size = ftell(fout);
   fseek(fout, valid_pos, SEEK_SET);
-  uint32_t lv = (uint32_t)last_valid;
-  fwrite(&lv, sizeof(uint32_t), 1, fout);
+  fputc(last_valid, fout);
 
+  free(in);
   fclose(fin);
   fclose(fout);
-  free_tree(root);
+  double t3 = now_sec();
 
   printf("\nCompression Complete\n");
   printf("Original size   : %llu bytes\n", (unsigned long long)orig_size);
-  printf("Compressed size : %ld bytes\n", ftell(fout));
+  printf("Compressed size : %ld bytes\n", comp_size);
   printf("Valid bits last byte : %d\n", last_valid);
+  printf("Histogram time  : %.4f s\n", t1 - t0);
+  printf("Table build time: %.4f s\n", t2 - t1);
+  printf("Encode time     : %.4f s\n", t3 - t2);
+  printf("Throughput      : %.1f MB/s\n", orig_size / (t3 - t0) / 1e6);
+  printf("Peak RSS        : %ld KiB\n", peak_rss_kib());
+
+  return 0;
+}
+
+// Single interleaved payload; the lanes are built in memory.
+int compress_file_x4(const char *input, const char *output) {
+  double t0 = now_sec();
+  int fd = open(input, O_RDONLY);
+  if (fd < 0) {
+    perror("Cannot open input");
+    return -1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  uint64_t orig_size = st.st_size;
+  if (orig_size == 0) {
+    close(fd);
+    printf("Input file is empty.\n");
+    return -1;
+  }
+
+  uint8_t *in = mmap(NULL, orig_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (in == MAP_FAILED) {
+    perror("Cannot map input");
+    return -1;
+  }
+
+  size_t len;
+  double t1 = now_sec();
+  uint8_t *buf = encode_block_x4(in, orig_size, &len);
+  double t2 = now_sec();
+  munmap(in, orig_size);
+  if (!buf)
+    return -1;
+
+  FILE *fout = fopen(output, "wb");
+  if (!fout) {
+    perror("Cannot open output");
+    free(buf);
+    return -1;
+  }
+  fwrite(buf, 1, len, fout);
+  fclose(fout);
+  free(buf);
+
+  printf("\nCompression Complete\n");
+  printf("Original size   : %llu bytes\n", (unsigned long long)orig_size);
+  printf("Compressed size : %llu bytes (%d interleaved streams)\n",
+         (unsigned long long)len, LANES);
+  printf("Encode time     : %.4f s\n", t2 - t1);
+  printf("Throughput      : %.1f MB/s\n", orig_size / (now_sec() - t0) / 1e6);
+  printf("Peak RSS        : %ld KiB\n", peak_rss_kib());
+  return 0;
+}
+
+/*
+ * Container format (all integers little-endian, as written by fwrite):
+ *   "HZB2" | u32 block_size | u32 seek_interval | u64 orig_size
+ *   u32 n_blocks | n_blocks x { u64 offset, u32 raw_size, u32 comp_size }
+ *   seek table: for each block, (raw_size - 1) / seek_interval u64 bit
+ *     offsets into its bitstream, one per seek_interval raw bytes
+ *   blocks, each a complete single-stream payload
+ * Blocks are independent, so they compress and decompress in parallel,
+ * and the seek table lets a reader start decoding near any raw offset.
+ * Interleaved blocks carry no seek marks (seek_interval is 0).
+ */
+typedef struct {
+  uint64_t offset;
+  uint32_t raw_size;
+  uint32_t comp_size;
+} BlockEntry;
+
+typedef struct {
+  const uint8_t *in;
+  uint64_t size;
+  uint32_t block_size;
+  uint32_t n_blocks;
+  uint32_t seek_interval;
+  uint32_t marks_per_block; // Seek marks in every full block
+  int interleave;
+  uint64_t *seek;           // Seek table, filled in by the workers
+  uint8_t **out;            // Finished blocks waiting to be written
+  size_t *out_len;
+  uint32_t next_block; // Next block to hand to a worker
+  uint32_t next_write; // Next block the writer is waiting for
+  uint32_t window;     // Max blocks in flight ahead of the writer
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} BlockJob;
+
+void *compress_worker(void *arg) {
+  BlockJob *job = arg;
+
+  pthread_mutex_lock(&job->lock);
+  while (1) {
+    while (job->next_block < job->n_blocks &&
+           job->next_block >= job->next_write + job->window)
+      pthread_cond_wait(&job->cond, &job->lock);
+    if (job->next_block >= job->n_blocks)
+      break;
+    uint32_t i = job->next_block++;
+    pthread_mutex_unlock(&job->lock);
+
+    uint64_t start = (uint64_t)i * job->block_size;
+    uint64_t n = job->size - start;
+    if (n > job->block_size)
+      n = job->block_size;
+    size_t len;
+    uint8_t *buf =
+        job->interleave
+            ? encode_block_x4(job->in + start, n, &len)
+            : encode_block(job->in + start, n, &len,
+                           job->seek + (uint64_t)i * job->marks_per_block,
+                           job->seek_interval);
+
+    pthread_mutex_lock(&job->lock);
+    job->out[i] = buf;
+    job->out_len[i] = len;
+    pthread_cond_broadcast(&job->cond);
+  }
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+int compress_blocks(const char *input, const char *output, int threads,
+                    uint32_t block_size, uint32_t seek_interval,
+                    int interleave) {
+  int fd = open(input, O_RDONLY);
+  if (fd < 0) {
+    perror("Cannot open input");
+    return -1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  uint64_t orig_size = st.st_size;
+  if (orig_size == 0) {
+    close(fd);
+    printf("Input file is empty.\n");
+    return -1;
+  }
+
+  uint8_t *in = mmap(NULL, orig_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (in == MAP_FAILED) {
+    perror("Cannot map input");
+    return -1;
+  }
+
+  FILE *fout = fopen(output, "wb");
+  if (!fout) {
+    perror("Cannot open output");
+    munmap(in, orig_size);
+    return -1;
+  }
+
+  double t0 = now_sec();
+
+  BlockJob job;
+  job.in = in;
+  job.size = orig_size;
+  job.block_size = block_size;
+  job.n_blocks = (orig_size + block_size - 1) / block_size;
+  if (interleave)
+    seek_interval = 0;
+  job.seek_interval = seek_interval;
+  job.marks_per_block = seek_interval ? (block_size - 1) / seek_interval : 0;
+  job.interleave = interleave;
+  job.out = calloc(job.n_blocks, sizeof(uint8_t *));
+  job.out_len = calloc(job.n_blocks, sizeof(size_t));
+  job.next_block = 0;
+  job.next_write = 0;
+  job.window = 2 * threads;
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.cond, NULL);
+
+  BlockEntry *index = calloc(job.n_blocks, sizeof(BlockEntry));
+
+  // Only the last block can be short, so the seek table size is known now
+  uint64_t last_raw = orig_size - (uint64_t)(job.n_blocks - 1) * block_size;
+  uint64_t n_marks =
+      seek_interval ? (uint64_t)(job.n_blocks - 1) * job.marks_per_block +
+                          (last_raw - 1) / seek_interval
+                    : 0;
+  job.seek = calloc(n_marks + 1, sizeof(uint64_t));
+
+  fwrite(CONTAINER_MAGIC, 1, 4, fout);
+  fwrite(&block_size, sizeof(uint32_t), 1, fout);
+  fwrite(&seek_interval, sizeof(uint32_t), 1, fout);
+  fwrite(&orig_size, sizeof(uint64_t), 1, fout);
+  fwrite(&job.n_blocks, sizeof(uint32_t), 1, fout);
+  long index_pos = ftell(fout);
+  fwrite(index, sizeof(BlockEntry), job.n_blocks, fout);
+  fwrite(job.seek, sizeof(uint64_t), n_marks, fout);
+  uint64_t offset = ftell(fout);
+
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  for (int t = 0; t < threads; t++)
+    pthread_create(&tids[t], NULL, compress_worker, &job);
+
+  // Write finished blocks in order while workers keep going
+  for (uint32_t i = 0; i < job.n_blocks; i++) {
+    pthread_mutex_lock(&job.lock);
+    while (!job.out[i])
+      pthread_cond_wait(&job.cond, &job.lock);
+    uint8_t *buf = job.out[i];
+    size_t len = job.out_len[i];
+    job.out[i] = NULL;
+    job.next_write = i + 1;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.lock);
+
+    fwrite(buf, 1, len, fout);
+    free(buf);
+
+    uint64_t start = (uint64_t)i * block_size;
+    index[i].offset = offset;
+    index[i].raw_size = (orig_size - start < block_size)
+                            ? (uint32_t)(orig_size - start)
+                            : block_size;
+    index[i].comp_size = (uint32_t)len;
+    offset += len;
+  }
+
+  for (int t = 0; t < threads; t++)
+    pthread_join(tids[t], NULL);
+
+  fseek(fout, index_pos, SEEK_SET);
+  fwrite(index, sizeof(BlockEntry), job.n_blocks, fout);
+  fwrite(job.seek, sizeof(uint64_t), n_marks, fout);
+  fclose(fout);
+
+  double secs = now_sec() - t0;
+
+  pthread_mutex_destroy(&job.lock);
+  pthread_cond_destroy(&job.cond);
+  free(tids);
+  free(index);
+  free(job.seek);
+  free(job.out);
+  free(job.out_len);
+  munmap(in, orig_size);
+
+  printf("\nCompression Complete\n");
+  printf("Original size   : %llu bytes\n", (unsigned long long)orig_size);
+  printf("Compressed size : %llu bytes\n", (unsigned long long)offset);
+  printf("Blocks          : %u x %u bytes, %d threads\n", job.n_blocks,
+         block_size, threads);
+  printf("Seek marks      : %llu (every %u bytes)\n",
+         (unsigned long long)n_marks, seek_interval);
+  printf("Throughput      : %.1f MB/s\n", orig_size / secs / 1e6);
+  printf("Peak RSS        : %ld KiB\n", peak_rss_kib());
 
   return 0;
 }
 
+/*
+ * Stream format, for pipes where the size is unknown up front:
+ *   "HZS1" | frames of { u32 raw_size, u32 comp_size, payload } | {0, 0}
+ * Each frame is one block with its own table, so memory use is bounded by
+ * the block size no matter how long the stream runs.
+ */
+int compress_stream(FILE *fin, FILE *fout, uint32_t block_size,
+                    int interleave) {
+  uint8_t *in = malloc(block_size);
+  uint64_t orig_size = 0, comp_size = 4;
+  uint32_t frames = 0;
+  size_t n;
+
+  fwrite(STREAM_MAGIC, 1, 4, fout);
+
+  while ((n = fread(in, 1, block_size, fin)) > 0) {
+    size_t len;
+    uint8_t *buf = interleave ? encode_block_x4(in, n, &len)
+                              : encode_block(in, n, &len, NULL, 0);
+    uint32_t sizes[2] = {(uint32_t)n, (uint32_t)len};
+    fwrite(sizes, sizeof(uint32_t), 2, fout);
+    fwrite(buf, 1, len, fout);
+    fflush(fout);
+    free(buf);
+
+    orig_size += n;
+    comp_size += sizeof(sizes) + len;
+    frames++;
+  }
+
+  uint32_t end[2] = {0, 0};
+  fwrite(end, sizeof(uint32_t), 2, fout);
+  fflush(fout);
+  comp_size += sizeof(end);
+  free(in);
+
+  // Stats go to stderr so they never mix with compressed output on stdout
+  fprintf(stderr, "\nCompression Complete\n");
+  fprintf(stderr, "Original size   : %llu bytes\n",
+          (unsigned long long)orig_size);
+  fprintf(stderr, "Compressed size : %llu bytes\n",
+          (unsigned long long)comp_size);
+  fprintf(stderr, "Frames          : %u x %u bytes max\n", frames,
+          block_size);
+  return ferror(fin) || ferror(fout) ? -1 : 0;
+}
+
+/*
+ * Batch mode: many files in one process. Workers take the next file from
+ * a shared list and write it as a single payload next to the input (or
+ * into the -o directory) with BATCH_SUFFIX appended.
+ */
+typedef struct {
+  char **paths;
+  char **outputs;
+  int count, cap;
+  const char *out_dir;
+  int interleave;
+  int next;
+  int done, failed;
+  uint64_t in_bytes, out_bytes;
+  pthread_mutex_t lock;
+} BatchJob;
+
+void batch_add(BatchJob *job, const char *path) {
+  if (job->count == job->cap) {
+    job->cap = job->cap ? job->cap * 2 : 64;
+    job->paths = realloc(job->paths, sizeof(char *) * job->cap);
+  }
+  job->paths[job->count++] = strdup(path);
+}
+
+// Adds a file, or every regular file directly inside a directory.
+void batch_collect(BatchJob *job, const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    perror(path);
+    job->failed++;
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    batch_add(job, path);
+    return;
+  }
+
+  DIR *dir = opendir(path);
+  if (!dir) {
+    perror(path);
+    job->failed++;
+    return;
+  }
+  struct dirent *ent;
+  char full[4096];
+  size_t suffix_len = strlen(BATCH_SUFFIX);
+  while ((ent = readdir(dir))) {
+    size_t len = strlen(ent->d_name);
+    if (ent->d_name[0] == '.' ||
+        (len > suffix_len &&
+         strcmp(ent->d_name + len - suffix_len, BATCH_SUFFIX) == 0))
+      continue;
+    snprintf(full, sizeof(full), "%s/%s", path, ent->d_name);
+    if (stat(full, &st) == 0 && S_ISREG(st.st_mode))
+      batch_add(job, full);
+  }
+  closedir(dir);
+}
+
+typedef struct {
+  const char *name;
+  int index;
+} BatchName;
+
+int batch_name_cmp(const void *a, const void *b) {
+  const BatchName *x = a, *y = b;
+  int c = strcmp(x->name, y->name);
+  return c ? c : x->index - y->index;
+}
+
+// Fills job->outputs; a file whose output name was already taken by an
+// earlier input (same basename under -o) is reported and left NULL.
+void batch_outputs(BatchJob *job) {
+  char output[4096];
+  job->outputs = malloc(sizeof(char *) * (job->count ? job->count : 1));
+  BatchName *names = malloc(sizeof(BatchName) * (job->count ? job->count : 1));
+  for (int i = 0; i < job->count; i++) {
+    const char *input = job->paths[i];
+    if (job->out_dir) {
+      const char *base = strrchr(input, '/');
+      snprintf(output, sizeof(output), "%s/%s%s", job->out_dir,
+               base ? base + 1 : input, BATCH_SUFFIX);
+    } else {
+      snprintf(output, sizeof(output), "%s%s", input, BATCH_SUFFIX);
+    }
+    job->outputs[i] = strdup(output);
+    names[i].name = job->outputs[i];
+    names[i].index = i;
+  }
+
+  qsort(names, job->count, sizeof(BatchName), batch_name_cmp);
+  for (int i = 1; i < job->count; i++) {
+    if (strcmp(names[i].name, names[i - 1].name) != 0)
+      continue;
+    int first = names[i - 1].index, dup = names[i].index;
+    // Keep pointing at the first holder so later duplicates name it too
+    names[i] = names[i - 1];
+    printf("Skipped %s (output %s already used by %s)\n", job->paths[dup],
+           job->outputs[dup], job->paths[first]);
+    free(job->outputs[dup]);
+    job->outputs[dup] = NULL;
+    job->failed++;
+  }
+  free(names);
+}
+
+int compress_one(const char *input, const char *output, int interleave,
+                 uint64_t *in_bytes, uint64_t *out_bytes) {
+  int fd = open(input, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  fstat(fd, &st);
+  size_t n = st.st_size;
+  if (n == 0) {
+    close(fd);
+    return -1;
+  }
+  uint8_t *in = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (in == MAP_FAILED)
+    return -1;
+
+  size_t len;
+  uint8_t *buf = interleave ? encode_block_x4(in, n, &len)
+                            : encode_block(in, n, &len, NULL, 0);
+  munmap(in, n);
+  if (!buf)
+    return -1;
+
+  FILE *fout = fopen(output, "wb");
+  int rc = -1;
+  if (fout) {
+    rc = fwrite(buf, 1, len, fout) == len ? 0 : -1;
+    fclose(fout);
+  }
+  free(buf);
+
+  *in_bytes = n;
+  *out_bytes = len;
+  return rc;
+}
+
+void *batch_worker(void *arg) {
+  BatchJob *job = arg;
+
+  while (1) {
+    pthread_mutex_lock(&job->lock);
+    int i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->count)
+      break;
+
+    const char *input = job->paths[i];
+    const char *output = job->outputs[i];
+    if (!output)
+      continue;
+
+    uint64_t in_bytes = 0, out_bytes = 0;
+    int rc = compress_one(input, output, job->interleave, &in_bytes,
+                          &out_bytes);
+
+    pthread_mutex_lock(&job->lock);
+    if (rc == 0) {
+      job->done++;
+      job->in_bytes += in_bytes;
+      job->out_bytes += out_bytes;
+    } else {
+      printf("Skipped %s (unreadable, empty or unwritable output)\n", input);
+      job->failed++;
+    }
+    pthread_mutex_unlock(&job->lock);
+  }
+  return NULL;
+}
+
+int compress_batch(char **inputs, int n_inputs, const char *out_dir,
+                   int threads, int interleave) {
+  BatchJob job;
+  memset(&job, 0, sizeof(job));
+  job.out_dir = out_dir;
+  job.interleave = interleave;
+  pthread_mutex_init(&job.lock, NULL);
+
+  for (int i = 0; i < n_inputs; i++)
+    batch_collect(&job, inputs[i]);
+  batch_outputs(&job);
+
+  double t0 = now_sec();
+  pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+  for (int t = 0; t < threads; t++)
+    pthread_create(&tids[t], NULL, batch_worker, &job);
+  for (int t = 0; t < threads; t++)
+    pthread_join(tids[t], NULL);
+  double secs = now_sec() - t0;
+
+  printf("\nBatch Compression Complete\n");
+  printf("Files           : %d compressed, %d failed, %d threads\n",
+         job.done, job.failed, threads);
+  printf("Original size   : %llu bytes\n", (unsigned long long)job.in_bytes);
+  printf("Compressed size : %llu bytes\n", (unsigned long long)job.out_bytes);
+  if (job.in_bytes)
+    printf("Ratio           : %.3f\n", (double)job.out_bytes / job.in_bytes);
+  printf("Throughput      : %.1f MB/s, %.0f files/s\n",
+         job.in_bytes / secs / 1e6, job.done / secs);
+
+  for (int i = 0; i < job.count; i++) {
+    free(job.paths[i]);
+    free(job.outputs[i]);
+  }
+  free(job.paths);
+  free(job.outputs);
+  free(tids);
+  pthread_mutex_destroy(&job.lock);
+  return job.failed ? -1 : 0;
+}
+
+uint64_t xorshift(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// Synthetic gateway log lines: timestamps, levels and meter readings.
+void fill_log_like(uint8_t *buf, size_t n) {
+  static const char *levels[] = {"INFO", "WARN", "ERROR", "DEBUG"};
+  uint64_t rng = 88172645463325252ULL;
+  size_t pos = 0;
+  char line[128];
+  while (pos < n) {
+    uint64_t r = xorshift(&rng);
+    int len = snprintf(line, sizeof(line),
+                       "2026-10-%02d 12:%02d:%02d [%s] meter=%04d "
+                       "power=%d.%02dkW voltage=%dV\n",
+                       (int)(r % 28) + 1, (int)(r >> 8) % 60,
+                       (int)(r >> 16) % 60, levels[(r >> 24) % 4],
+                       1000 + (int)((r >> 28) % 9000), (int)(r >> 42) % 10,
+                       (int)(r >> 46) % 100, 220 + (int)(r >> 54) % 21);
+    for (int i = 0; i < len && pos < n; i++)
+      buf[pos++] = line[i];
+  }
+}
+
+void fill_random(uint8_t *buf, size_t n) {
+  uint64_t rng = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < n; i++)
+    buf[i] = (uint8_t)(xorshift(&rng) >> 32);
+}
+
+// The single-table counting loop count_freq() replaced, kept for comparison.
+void count_freq_simple(const uint8_t *in, size_t n, uint64_t freq[256]) {
+  for (size_t i = 0; i < n; i++)
+    freq[in[i]]++;
+}
+
+int microbench(size_t mib) {
+  size_t n = mib << 20;
+  uint8_t *buf = malloc(n);
+  const char *names[2] = {"log-like", "random"};
+  int ok = 1;
+
+  printf("\nMicrobenchmark (%zu MiB per input, best of 3)\n", mib);
+  for (int d = 0; d < 2; d++) {
+    if (d == 0)
+      fill_log_like(buf, n);
+    else
+      fill_random(buf, n);
+
+    double best[4] = {1e9, 1e9, 1e9, 1e9};
+    uint64_t fa[256], fb[256];
+    size_t len1 = 0, len4 = 0;
+    for (int rep = 0; rep < 3; rep++) {
+      double t0 = now_sec();
+      memset(fa, 0, sizeof(fa));
+      count_freq_simple(buf, n, fa);
+      double t1 = now_sec();
+      memset(fb, 0, sizeof(fb));
+      count_freq(buf, n, fb);
+      double t2 = now_sec();
+      free(encode_block(buf, n, &len1, NULL, 0));
+      double t3 = now_sec();
+      free(encode_block_x4(buf, n, &len4));
+      double t4 = now_sec();
+
+      double t[4] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3};
+      for (int k = 0; k < 4; k++)
+        if (t[k] < best[k])
+          best[k] = t[k];
+    }
+    if (memcmp(fa, fb, sizeof(fa)) != 0)
+      ok = 0;
+
+    printf("%s:\n", names[d]);
+    printf("  histogram, 1 table       : %8.1f MB/s\n", n / best[0] / 1e6);
+    printf("  histogram, 4 sub-tables  : %8.1f MB/s\n", n / best[1] / 1e6);
+    printf("  encode, 1 stream         : %8.1f MB/s  (%zu bytes)\n",
+           n / best[2] / 1e6, len1);
+    printf("  encode, %d interleaved    : %8.1f MB/s  (%zu bytes)\n", LANES,
+           n / best[3] / 1e6, len4);
+  }
+  printf("Histograms match: %s\n", ok ? "yes" : "NO");
+
+  free(buf);
+  return ok ? 0 : -1;
+}
+
+// Block and seek sizes are stored as u32 bytes.
+int parse_kib(const char *s, uint32_t *bytes) {
+  char *end;
+  unsigned long kib = strtoul(s, &end, 10);
+  if (*s == '-' || end == s || *end || kib == 0 || kib > MAX_KIB)
+    return 0;
+  *bytes = (uint32_t)kib * 1024;
+  return 1;
+}
+
+void usage(const char *prog) {
+  printf("Usage: %s [-j threads] [-b block_kib] [-s seek_kib] [-4] "
+         "[-o output] <input.txt>\n",
+         prog);
+  printf("       %s --batch [-j threads] [-4] [-o out_dir] <file|dir>...\n",
+         prog);
+  printf("       %s --microbench [mib]\n", prog);
+  printf("  -j / -b / -s write the multi-block container format\n");
+  printf("  -4 codes each block as %d interleaved bitstreams: decodes a\n"
+         "     little faster, encodes slower (single stream is the default;\n"
+         "     bench.sh measures both sides)\n", LANES);
+  printf("  input '-' compresses stdin as a stream (to stdout unless -o)\n");
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s <input.txt>\n", argv[0]);
+  const char *input = NULL;
+  const char *output = NULL;
+  int threads = 0;
+  uint32_t block_size = 0;
+  uint32_t seek_interval = 0;
+  int interleave = 0;
+  int batch = 0;
+  char **inputs = malloc(sizeof(char *) * argc);
+  int n_inputs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--batch") == 0)
+      batch = 1;
+    else if (strcmp(argv[i], "--microbench") == 0) {
+      size_t mib = (i + 1 < argc) ? (size_t)atoi(argv[i + 1]) : 0;
+      free(inputs);
+      return microbench(mib > 0 ? mib : 64) == 0 ? 0 : 1;
+    } else if (strcmp(argv[i], "-4") == 0)
+      interleave = 1;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-s") == 0) &&
+             i + 1 < argc) {
+      uint32_t *size = argv[i][1] == 'b' ? &block_size : &seek_interval;
+      if (!parse_kib(argv[++i], size)) {
+        printf("%s must be 1..%u KiB\n", argv[i - 1], MAX_KIB);
+        free(inputs);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      output = argv[++i];
+    else
+      input = inputs[n_inputs++] = argv[i];
+  }
+
+  if (!input) {
+    usage(argv[0]);
+    free(inputs);
     return 1;
   }
 
-  compress_file(argv[1], "compressed.log");
-  return 0;
+  if (threads <= 0 && batch)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (batch) {
+    int rc = compress_batch(inputs, n_inputs, output, threads > 0 ? threads : 1,
+                            interleave);
+    free(inputs);
+    return rc == 0 ? 0 : 1;
+  }
+  free(inputs);
+
+  if (strcmp(input, "-") == 0) {
+    FILE *fout = stdout;
+    if (output && strcmp(output, "-") != 0 && !(fout = fopen(output, "wb"))) {
+      perror("Cannot open output");
+      return 1;
+    }
+    int rc = compress_stream(stdin, fout,
+                             block_size ? block_size : DEFAULT_BLOCK_SIZE,
+                             interleave);
+    if (fout != stdout)
+      fclose(fout);
+    return rc == 0 ? 0 : 1;
+  }
+
+  if (!output)
+    output = "compressed.log";
+
+  if (threads > 0 || block_size > 0 || seek_interval > 0) {
+    if (threads <= 0)
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+      threads = 1;
+    if (block_size == 0)
+      block_size = DEFAULT_BLOCK_SIZE;
+    if (seek_interval == 0)
+      seek_interval = DEFAULT_SEEK_INTERVAL;
+    return compress_blocks(input, output, threads, block_size,
+                           seek_interval, interleave) == 0
+               ? 0
+               : 1;
+  }
+
+  if (interleave)
+    return compress_file_x4(input, output) == 0 ? 0 : 1;
+
+  return compress_file(input, output) == 0 ? 0 : 1;
 }
@@ -1,6 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOOKUP_BITS 11          // Bits resolved per table lookup
+#define IO_BUF_SIZE (1 << 20)   // 1 MiB read/write buffers
+#define MAX_CODE_LEN 15         // Longest canonical code
+#define PAYLOAD_MAGIC "HZC1"
+#define PAYLOAD_X4_MAGIC "HZC4"
+#define LANES 4                 // Bitstreams in an interleaved payload
+#define CONTAINER_MAGIC_V1 "HZB1"
+#define CONTAINER_MAGIC "HZB2"
+#define STREAM_MAGIC "HZS1"
 
 typedef struct HNode {
     unsigned char symbol;
@@ -8,6 +26,25 @@ typedef struct HNode {
     struct HNode *right;
 } HNode;
 
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kib(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;     // bytes on macOS
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+// Time this thread spent rebuilding code tables, for the stats output.
+_Thread_local double table_secs;
+
 HNode* new_node(unsigned char sym) {
     HNode *node = calloc(1, sizeof(HNode));
     node->symbol = sym;
@@ -46,9 +83,23 @@ int br_read_bit(BitReader *br) {
     return bit;
 }
 
-HNode* read_table(FILE *f) {
-    uint32_t n_symbols;
-    fread(&n_symbols, sizeof(uint32_t), 1, f);
+void tree_insert(HNode *root, uint32_t bits, int len, uint8_t sym) {
+    HNode *cur = root;
+    for (int b = len - 1; b >= 0; b--) {
+        if (((bits >> b) & 1) == 0) {
+            if (!cur->left) cur->left = new_node(0);
+            cur = cur->left;
+        } else {
+            if (!cur->right) cur->right = new_node(0);
+            cur = cur->right;
+        }
+    }
+    cur->symbol = sym;
+}
+
+// Legacy header: every symbol with its length and raw code bytes.
+HNode* read_table(FILE *f, uint32_t n_symbols) {
+    if (n_symbols > 256) return NULL;
 
     HNode *root = new_node(0);
 
@@ -56,51 +107,188 @@ HNode* read_table(FILE *f) {
         uint8_t sym, len;
         fread(&sym, 1, 1, f);
         fread(&len, 1, 1, f);
+        if (len > 32) { free_tree(root); return NULL; }
 
         int nbytes = (len + 7) / 8;
         uint8_t cbytes[4] = {0};
         fread(cbytes, 1, nbytes, f);
 
+        uint32_t bits = 0;
+        for (int b = 0; b < len; b++)
+            bits = (bits << 1) | ((cbytes[b / 8] >> (7 - b % 8)) & 1);
+        tree_insert(root, bits, len, sym);
+    }
+
+    return root;
+}
+
+// Canonical header: code lengths as nibbles for symbols 0..last.
+HNode* read_lengths(FILE *f) {
+    int last = fgetc(f);
+    if (last == EOF) return NULL;
+
+    uint8_t lens[256] = {0};
+    for (int s = 0; s <= last; s += 2) {
+        int c = fgetc(f);
+        if (c == EOF) return NULL;
+        lens[s] = c >> 4;
+        if (s + 1 <= last) lens[s + 1] = c & 0x0F;
+    }
+
+    // Reject over-subscribed length sets before building anything
+    int bl_count[MAX_CODE_LEN + 1] = {0};
+    uint32_t kraft = 0;
+    for (int s = 0; s < 256; s++) {
+        bl_count[lens[s]]++;
+        if (lens[s]) kraft += 1u << (MAX_CODE_LEN - lens[s]);
+    }
+    if (kraft > (1u << MAX_CODE_LEN)) return NULL;
+
+    uint32_t next_code[MAX_CODE_LEN + 1] = {0};
+    uint32_t code = 0;
+    bl_count[0] = 0;
+    for (int len = 1; len <= MAX_CODE_LEN; len++) {
+        code = (code + bl_count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+
+    HNode *root = new_node(0);
+    for (int s = 0; s < 256; s++)
+        if (lens[s])
+            tree_insert(root, next_code[lens[s]]++, lens[s], (uint8_t)s);
+    return root;
+}
+
+/*
+ * Lookup-table decoding: each entry covers LOOKUP_BITS bits of input.
+ * Codes no longer than LOOKUP_BITS resolve in one step; longer codes
+ * store the tree node reached after LOOKUP_BITS bits and finish the walk
+ * bit by bit. Entries with neither are invalid bit patterns.
+ */
+typedef struct {
+    uint8_t symbol;
+    uint8_t len;        // 0 = not resolved by this entry
+    HNode *node;        // Continue from here when len == 0
+} LookupEntry;
+
+void build_lookup(HNode *root, LookupEntry *table) {
+    for (uint32_t idx = 0; idx < (1u << LOOKUP_BITS); idx++) {
         HNode *cur = root;
-        for (int b = 0; b < len; b++) {
-            int bit = (cbytes[b / 8] >> (7 - b % 8)) & 1;
-            if (bit == 0) {
-                if (!cur->left) cur->left = new_node(0);
-                cur = cur->left;
-            } else {
-                if (!cur->right) cur->right = new_node(0);
-                cur = cur->right;
+        int depth = 0;
+        table[idx].symbol = 0;
+        table[idx].len = 0;
+        table[idx].node = NULL;
+
+        while (cur && depth < LOOKUP_BITS) {
+            int bit = (idx >> (LOOKUP_BITS - 1 - depth)) & 1;
+            cur = bit ? cur->right : cur->left;
+            depth++;
+            if (cur && !cur->left && !cur->right) {
+                table[idx].symbol = cur->symbol;
+                table[idx].len = depth;
+                break;
             }
         }
-        cur->symbol = sym;
+        if (cur && !table[idx].len)
+            table[idx].node = cur;
     }
+}
 
-    return root;
+// Big-endian 64-bit bit buffer fed from a buffered file.
+typedef struct {
+    FILE *f;
+    uint8_t *buf;
+    size_t len, pos;
+    uint64_t bits;      // Next bits of the stream, MSB first
+    int count;          // Valid bits in `bits`
+} BitStream;
+
+void bs_init(BitStream *bs, FILE *f) {
+    bs->f = f;
+    bs->buf = malloc(IO_BUF_SIZE);
+    bs->len = bs->pos = 0;
+    bs->bits = 0;
+    bs->count = 0;
 }
 
-int decompress_file(const char *input, const char *output) {
-    FILE *fin = fopen(input, "rb");
-    if (!fin) { perror("Cannot open input"); return -1; }
+// Reads straight from caller memory; nothing is freed.
+void bs_init_mem(BitStream *bs, uint8_t *src, size_t len) {
+    bs->f = NULL;
+    bs->buf = src;
+    bs->len = len;
+    bs->pos = 0;
+    bs->bits = 0;
+    bs->count = 0;
+}
 
-    HNode *root = read_table(fin);
-    if (!root) { fclose(fin); return -1; }
+void bs_refill(BitStream *bs) {
+    if (bs->pos + 8 <= bs->len) {
+        // Fast path: top up with a single 8-byte load
+        uint64_t word = 0;
+        for (int i = 0; i < 8; i++)
+            word = (word << 8) | bs->buf[bs->pos + i];
+        int take = (63 - bs->count) >> 3;
+        bs->bits |= (word >> bs->count) & ~(~0ULL >> (bs->count + take * 8));
+        bs->pos += take;
+        bs->count += take * 8;
+        return;
+    }
+    while (bs->count <= 56) {
+        if (bs->pos == bs->len) {
+            if (!bs->f) return;
+            bs->len = fread(bs->buf, 1, IO_BUF_SIZE, bs->f);
+            bs->pos = 0;
+            if (bs->len == 0) return;
+        }
+        bs->bits |= (uint64_t)bs->buf[bs->pos++] << (56 - bs->count);
+        bs->count += 8;
+    }
+}
 
-    uint64_t orig_size;
-    uint32_t last_valid_bits;
-    fread(&orig_size, sizeof(uint64_t), 1, fin);
-    fread(&last_valid_bits, sizeof(uint32_t), 1, fin);
+void bs_consume(BitStream *bs, int n) {
+    bs->bits <<= n;
+    bs->count -= n;
+}
 
-    FILE *fout = fopen(output, "wb");
-    if (!fout) { perror("Cannot open output"); fclose(fin); free_tree(root); return -1; }
+// Decoded output: either buffered to a file or written into caller memory.
+typedef struct {
+    FILE *f;            // NULL = fixed memory destination
+    uint8_t *buf;
+    size_t len, cap;
+    uint64_t discard;   // Leading file-bound bytes to drop (range reads)
+} OutBuf;
 
-    // Calculate total bits in compressed data
-    long start_pos = ftell(fin);
-    fseek(fin, 0, SEEK_END);
-    long end_pos = ftell(fin);
-    fseek(fin, start_pos, SEEK_SET);
-    long data_bytes = end_pos - start_pos;
-    uint64_t total_bits = (data_bytes > 0) ? (uint64_t)(data_bytes - 1) * 8 + last_valid_bits : 0;
+void ob_init(OutBuf *ob, FILE *f) {
+    ob->f = f;
+    ob->buf = malloc(IO_BUF_SIZE);
+    ob->len = 0;
+    ob->cap = IO_BUF_SIZE;
+    ob->discard = 0;
+}
+
+void ob_init_mem(OutBuf *ob, uint8_t *dst, size_t cap) {
+    ob->f = NULL;
+    ob->buf = dst;
+    ob->len = 0;
+    ob->cap = cap;
+    ob->discard = 0;
+}
+
+void ob_flush(OutBuf *ob) {
+    if (!ob->f) return;
+    size_t skip = ob->discard < ob->len ? (size_t)ob->discard : ob->len;
+    fwrite(ob->buf + skip, 1, ob->len - skip, ob->f);
+    ob->discard -= skip;
+    ob->len = 0;
+}
+
+void ob_free(OutBuf *ob) {
+    ob_flush(ob);
+    if (ob->f) free(ob->buf);
+}
 
+uint64_t decode_tree(FILE *fin, OutBuf *ob, HNode *root,
+                     uint64_t orig_size, uint64_t total_bits) {
     BitReader br;
     br_init(&br, fin);
 
@@ -115,32 +303,869 @@ int decompress_file(const char *input, const char *output) {
 
         cur = bit ? cur->right : cur->left;
         if (!cur) {
-            printf("ERROR: Corrupt compressed data.\n");
+            fprintf(stderr, "ERROR: Corrupt compressed data.\n");
             break;
         }
 
         if (!cur->left && !cur->right) {
-            fputc(cur->symbol, fout);
+            ob->buf[ob->len++] = cur->symbol;
+            if (ob->len == ob->cap) ob_flush(ob);
             decoded++;
             cur = root;
         }
     }
+    return decoded;
+}
+
+// Decodes after dropping the first `skip` (< 8) bits of the stream.
+uint64_t decode_table(FILE *fin, OutBuf *ob, HNode *root, uint64_t orig_size,
+                      uint64_t total_bits, int skip) {
+    LookupEntry *table = malloc(sizeof(LookupEntry) << LOOKUP_BITS);
+    double t0 = now_sec();
+    build_lookup(root, table);
+    table_secs += now_sec() - t0;
+
+    BitStream bs;
+    bs_init(&bs, fin);
+    bs_refill(&bs);
+    if (skip > bs.count) skip = bs.count;
+    bs_consume(&bs, skip);
+
+    uint64_t decoded = 0;
+    uint64_t bits_read = skip;
+
+    while (decoded < orig_size && bits_read < total_bits) {
+        if (bs.count < LOOKUP_BITS) bs_refill(&bs);
+
+        LookupEntry e = table[bs.bits >> (64 - LOOKUP_BITS)];
+        if (e.len) {
+            if (bits_read + e.len > total_bits || e.len > bs.count) break;
+            bs_consume(&bs, e.len);
+            bits_read += e.len;
+            ob->buf[ob->len++] = e.symbol;
+        } else if (e.node) {
+            // Long code: finish the walk one bit at a time
+            if (bits_read + LOOKUP_BITS > total_bits || bs.count < LOOKUP_BITS) break;
+            bs_consume(&bs, LOOKUP_BITS);
+            bits_read += LOOKUP_BITS;
+            HNode *cur = e.node;
+            while (cur && (cur->left || cur->right) && bits_read < total_bits) {
+                if (bs.count == 0) bs_refill(&bs);
+                if (bs.count == 0) break;
+                int bit = bs.bits >> 63;
+                bs_consume(&bs, 1);
+                bits_read++;
+                cur = bit ? cur->right : cur->left;
+            }
+            if (!cur) {
+                fprintf(stderr, "ERROR: Corrupt compressed data.\n");
+                break;
+            }
+            if (cur->left || cur->right) break;
+            ob->buf[ob->len++] = cur->symbol;
+        } else {
+            fprintf(stderr, "ERROR: Corrupt compressed data.\n");
+            break;
+        }
+
+        decoded++;
+        if (ob->len == ob->cap) ob_flush(ob);
+    }
+
+    free(bs.buf);
+    free(table);
+    return decoded;
+}
+
+// Decodes one symbol through the lookup table; -1 on corrupt or exhausted input.
+static inline int decode_one(const LookupEntry *table, BitStream *bs,
+                             uint64_t *bits_read, uint64_t total_bits) {
+    if (bs->count < LOOKUP_BITS) bs_refill(bs);
+
+    LookupEntry e = table[bs->bits >> (64 - LOOKUP_BITS)];
+    if (e.len) {
+        if (*bits_read + e.len > total_bits || e.len > bs->count) return -1;
+        bs_consume(bs, e.len);
+        *bits_read += e.len;
+        return e.symbol;
+    }
+    if (!e.node || *bits_read + LOOKUP_BITS > total_bits || bs->count < LOOKUP_BITS)
+        return -1;
+
+    bs_consume(bs, LOOKUP_BITS);
+    *bits_read += LOOKUP_BITS;
+    HNode *cur = e.node;
+    while (cur && (cur->left || cur->right) && *bits_read < total_bits) {
+        if (bs->count == 0) bs_refill(bs);
+        if (bs->count == 0) return -1;
+        int bit = bs->bits >> 63;
+        bs_consume(bs, 1);
+        (*bits_read)++;
+        cur = bit ? cur->right : cur->left;
+    }
+    if (!cur || cur->left || cur->right) return -1;
+    return cur->symbol;
+}
+
+/*
+ * Interleaved payload: byte i lives in lane i % LANES. The fast path
+ * decodes one symbol from every lane per iteration, giving the CPU
+ * LANES independent chains; the reference path drains lanes one by one.
+ */
+uint64_t decode_lanes(FILE *fin, OutBuf *ob, HNode *root,
+                      uint64_t orig_size, int reference) {
+    uint32_t sizes[LANES];
+    uint8_t last_valid[LANES];
+    if (fread(sizes, sizeof(sizes), 1, fin) != 1 ||
+        fread(last_valid, sizeof(last_valid), 1, fin) != 1)
+        return 0;
+
+    size_t total = 0;
+    for (int l = 0; l < LANES; l++) total += sizes[l];
+    uint8_t *src = malloc(total ? total : 1);
+    if (!src || fread(src, 1, total, fin) != total) {
+        free(src);
+        return 0;
+    }
+
+    LookupEntry *table = malloc(sizeof(LookupEntry) << LOOKUP_BITS);
+    double t0 = now_sec();
+    build_lookup(root, table);
+    table_secs += now_sec() - t0;
+
+    BitStream bs[LANES];
+    uint64_t bits_read[LANES] = {0}, total_bits[LANES];
+    size_t off = 0;
+    for (int l = 0; l < LANES; l++) {
+        bs_init_mem(&bs[l], src + off, sizes[l]);
+        total_bits[l] = sizes[l] ? (uint64_t)(sizes[l] - 1) * 8 + last_valid[l] : 0;
+        off += sizes[l];
+    }
+
+    // Output positions are strided, so decode into a whole-block buffer
+    uint8_t *dst = (!ob->f && ob->cap - ob->len >= orig_size)
+        ? ob->buf + ob->len : malloc(orig_size ? orig_size : 1);
+    uint64_t decoded = 0;
+    if (!dst) {
+        fprintf(stderr, "ERROR: Block too large.\n");
+        free(table);
+        free(src);
+        return 0;
+    }
+
+    if (reference) {
+        uint64_t lane_ok = orig_size;
+        for (int l = 0; l < LANES; l++)
+            for (uint64_t i = l; i < orig_size; i += LANES) {
+                int sym = decode_one(table, &bs[l], &bits_read[l], total_bits[l]);
+                if (sym < 0) { if (i < lane_ok) lane_ok = i; break; }
+                dst[i] = (uint8_t)sym;
+            }
+        decoded = lane_ok;
+    } else {
+        uint64_t i = 0;
+        int bad = 0;
+        for (; i + LANES <= orig_size; i += LANES) {
+            int a = decode_one(table, &bs[0], &bits_read[0], total_bits[0]);
+            int b = decode_one(table, &bs[1], &bits_read[1], total_bits[1]);
+            int c = decode_one(table, &bs[2], &bits_read[2], total_bits[2]);
+            int d = decode_one(table, &bs[3], &bits_read[3], total_bits[3]);
+            if ((a | b | c | d) < 0) { bad = 1; break; }
+            dst[i] = (uint8_t)a;
+            dst[i + 1] = (uint8_t)b;
+            dst[i + 2] = (uint8_t)c;
+            dst[i + 3] = (uint8_t)d;
+        }
+        for (; !bad && i < orig_size; i++) {
+            int sym = decode_one(table, &bs[i % LANES], &bits_read[i % LANES],
+                                 total_bits[i % LANES]);
+            if (sym < 0) break;
+            dst[i] = (uint8_t)sym;
+        }
+        decoded = i;
+    }
+    if (decoded < orig_size) fprintf(stderr, "ERROR: Corrupt compressed data.\n");
+
+    if (dst == ob->buf + ob->len) {
+        ob->len += decoded;
+    } else {
+        for (uint64_t i = 0; i < decoded; ) {
+            size_t n = ob->cap - ob->len;
+            if (n > decoded - i) n = decoded - i;
+            memcpy(ob->buf + ob->len, dst + i, n);
+            ob->len += n;
+            i += n;
+            if (ob->len == ob->cap) ob_flush(ob);
+        }
+        free(dst);
+    }
+
+    free(table);
+    free(src);
+    return decoded;
+}
+
+/*
+ * Sizes in a payload are untrusted. A memory destination is sized by the
+ * caller (container index or stream frame), so the payload must decode
+ * to exactly that many bytes; anything else is rejected before decoding.
+ */
+int fits_output(const OutBuf *ob, uint64_t orig_size, uint64_t max_out) {
+    if (ob->f) return 1;
+    if (orig_size != ob->cap - ob->len || max_out < orig_size) {
+        fprintf(stderr, "ERROR: Payload size does not match its block.\n");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Decodes one compressed stream; returns decoded bytes or -1 on error.
+ * Decoding starts start_bit bits into the bitstream (a seek mark) and
+ * stops after max_out bytes. The reference decoder is the bit-at-a-time
+ * tree walk, or lane-at-a-time decoding for interleaved payloads.
+ */
+int64_t decode_stream_at(FILE *fin, OutBuf *ob, int reference,
+                         uint64_t start_bit, uint64_t max_out) {
+    uint32_t first;
+    if (fread(&first, sizeof(uint32_t), 1, fin) != 1) {
+        fprintf(stderr, "ERROR: Truncated header.\n");
+        return -1;
+    }
+
+    if (memcmp(&first, PAYLOAD_X4_MAGIC, 4) == 0) {
+        double t0 = now_sec();
+        HNode *root = read_lengths(fin);
+        table_secs += now_sec() - t0;
+        if (!root) { fprintf(stderr, "ERROR: Invalid code table.\n"); return -1; }
+        uint64_t orig_size = 0;
+        fread(&orig_size, sizeof(uint64_t), 1, fin);
+        if (!fits_output(ob, orig_size, max_out)) { free_tree(root); return -1; }
+        if (max_out < orig_size) orig_size = max_out;
+        uint64_t decoded = decode_lanes(fin, ob, root, orig_size, reference);
+        free_tree(root);
+        if (decoded < orig_size) {
+            fprintf(stderr, "ERROR: Decoded %llu of %llu bytes.\n",
+                    (unsigned long long)decoded, (unsigned long long)orig_size);
+            return -1;
+        }
+        return (int64_t)decoded;
+    }
+
+    // Canonical payloads start with a magic; legacy ones with a symbol count
+    int canonical = memcmp(&first, PAYLOAD_MAGIC, 4) == 0;
+    double t0 = now_sec();
+    HNode *root = canonical ? read_lengths(fin) : read_table(fin, first);
+    table_secs += now_sec() - t0;
+    if (!root) { fprintf(stderr, "ERROR: Invalid code table.\n"); return -1; }
+
+    uint64_t orig_size = 0;
+    uint32_t last_valid_bits = 0;
+    fread(&orig_size, sizeof(uint64_t), 1, fin);
+    if (!fits_output(ob, orig_size, max_out)) { free_tree(root); return -1; }
+    if (canonical)
+        last_valid_bits = (uint32_t)fgetc(fin);
+    else
+        fread(&last_valid_bits, sizeof(uint32_t), 1, fin);
+
+    // Calculate total bits in compressed data
+    long start_pos = ftell(fin);
+    fseek(fin, 0, SEEK_END);
+    long end_pos = ftell(fin);
+    fseek(fin, start_pos, SEEK_SET);
+    long data_bytes = end_pos - start_pos;
+    uint64_t total_bits = (data_bytes > 0) ? (uint64_t)(data_bytes - 1) * 8 + last_valid_bits : 0;
+
+    if (start_bit > total_bits) start_bit = total_bits;
+    fseek(fin, start_pos + (long)(start_bit / 8), SEEK_SET);
+    total_bits -= start_bit / 8 * 8;
+    if (max_out < orig_size) orig_size = max_out;
+
+    uint64_t decoded = (reference && start_bit == 0)
+        ? decode_tree(fin, ob, root, orig_size, total_bits)
+        : decode_table(fin, ob, root, orig_size, total_bits, start_bit % 8);
+
+    free_tree(root);
+    if (decoded < orig_size) {
+        fprintf(stderr, "ERROR: Decoded %llu of %llu bytes.\n",
+                (unsigned long long)decoded, (unsigned long long)orig_size);
+        return -1;
+    }
+    return (int64_t)decoded;
+}
+
+int64_t decode_stream(FILE *fin, OutBuf *ob, int reference) {
+    return decode_stream_at(fin, ob, reference, 0, UINT64_MAX);
+}
+
+/*
+ * Container format (see main_compress.c):
+ *   "HZB2" | u32 block_size | u32 seek_interval | u64 orig_size
+ *   u32 n_blocks | n_blocks x { u64 offset, u32 raw_size, u32 comp_size }
+ *   seek table of u64 bit offsets, (raw_size - 1) / seek_interval per block
+ *   blocks, each a complete single-stream payload
+ * "HZB1" containers have no seek_interval field and no seek table.
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t raw_size;
+    uint32_t comp_size;
+} BlockEntry;
+
+typedef struct {
+    uint32_t block_size;
+    uint32_t seek_interval;     // 0 = no seek table
+    uint32_t marks_per_block;
+    uint64_t orig_size;
+    uint32_t n_blocks;
+    BlockEntry *index;
+    uint64_t *raw_offset;       // Output position of each block
+    uint64_t *seek;
+} Container;
+
+void free_container(Container *c) {
+    free(c->index);
+    free(c->raw_offset);
+    free(c->seek);
+}
+
+// Reads everything after the magic up to the first block.
+int read_container(FILE *fin, int version, Container *c) {
+    memset(c, 0, sizeof(*c));
+    if (fread(&c->block_size, sizeof(uint32_t), 1, fin) != 1 ||
+        (version >= 2 && fread(&c->seek_interval, sizeof(uint32_t), 1, fin) != 1) ||
+        fread(&c->orig_size, sizeof(uint64_t), 1, fin) != 1 ||
+        fread(&c->n_blocks, sizeof(uint32_t), 1, fin) != 1 ||
+        c->block_size == 0) {
+        fprintf(stderr, "ERROR: Truncated container header.\n");
+        return -1;
+    }
+
+    uint32_t n = c->n_blocks ? c->n_blocks : 1;
+    c->index = malloc(sizeof(BlockEntry) * n);
+    c->raw_offset = malloc(sizeof(uint64_t) * n);
+    if (fread(c->index, sizeof(BlockEntry), c->n_blocks, fin) != c->n_blocks) {
+        fprintf(stderr, "ERROR: Truncated block index.\n");
+        free_container(c);
+        return -1;
+    }
+
+    uint64_t total = 0, n_marks = 0;
+    for (uint32_t i = 0; i < c->n_blocks; i++) {
+        c->raw_offset[i] = total;
+        total += c->index[i].raw_size;
+        if (c->index[i].raw_size > c->block_size ||
+            (i + 1 < c->n_blocks && c->index[i].raw_size != c->block_size))
+            total = UINT64_MAX - 1;
+        if (c->seek_interval && c->index[i].raw_size)
+            n_marks += (c->index[i].raw_size - 1) / c->seek_interval;
+    }
+    if (total != c->orig_size) {
+        fprintf(stderr, "ERROR: Block index does not match original size.\n");
+        free_container(c);
+        return -1;
+    }
+
+    if (c->seek_interval) {
+        c->marks_per_block = (c->block_size - 1) / c->seek_interval;
+        c->seek = malloc(sizeof(uint64_t) * (n_marks + 1));
+        if (fread(c->seek, sizeof(uint64_t), n_marks, fin) != n_marks) {
+            fprintf(stderr, "ERROR: Truncated seek table.\n");
+            free_container(c);
+            return -1;
+        }
+    }
+
+    // Blocks must lie between the end of the tables and the end of the file
+    struct stat st;
+    off_t data_start = ftello(fin);
+    if (fstat(fileno(fin), &st) != 0 || data_start < 0) {
+        fprintf(stderr, "ERROR: Container is not a regular file.\n");
+        free_container(c);
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    for (uint32_t i = 0; i < c->n_blocks; i++) {
+        const BlockEntry *e = &c->index[i];
+        if (e->offset < (uint64_t)data_start || e->comp_size > size ||
+            e->offset > size - e->comp_size) {
+            fprintf(stderr, "ERROR: Block %u lies outside the container data.\n", i);
+            free_container(c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const uint8_t *map;     // Whole compressed file
+    size_t map_size;
+    BlockEntry *index;
+    uint64_t *raw_offset;   // Output position of each block
+    uint32_t n_blocks;
+    uint32_t next_block;
+    int out_fd;
+    int failed;
+    uint64_t decoded;
+    pthread_mutex_t lock;
+} BlockJob;
+
+// Decodes one container block into memory; returns decoded bytes or -1.
+int64_t decode_block(const uint8_t *src, uint32_t comp_size,
+                     uint8_t *dst, uint32_t raw_size) {
+    FILE *fin = fmemopen((void *)src, comp_size, "rb");
+    if (!fin) return -1;
+    OutBuf ob;
+    ob_init_mem(&ob, dst, raw_size);
+    int64_t decoded = decode_stream_at(fin, &ob, 0, 0, raw_size);
+    fclose(fin);
+    return decoded;
+}
+
+void *decompress_worker(void *arg) {
+    BlockJob *job = arg;
+    uint8_t *dst = NULL;
+    uint32_t dst_cap = 0;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        uint32_t i = job->next_block++;
+        int stop = job->failed;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->n_blocks || stop) break;
+
+        BlockEntry *e = &job->index[i];
+        if (e->raw_size > dst_cap) {
+            dst_cap = e->raw_size;
+            dst = realloc(dst, dst_cap);
+        }
+
+        int64_t decoded = -1;
+        if (e->comp_size <= job->map_size &&
+            e->offset <= job->map_size - e->comp_size)
+            decoded = decode_block(job->map + e->offset, e->comp_size,
+                                   dst, e->raw_size);
+        if (decoded == e->raw_size &&
+            pwrite(job->out_fd, dst, e->raw_size, job->raw_offset[i]) != e->raw_size)
+            decoded = -1;
+
+        pthread_mutex_lock(&job->lock);
+        if (decoded != e->raw_size) {
+            fprintf(stderr, "ERROR: Block %u failed to decode.\n", i);
+            job->failed = 1;
+        } else {
+            job->decoded += decoded;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(dst);
+    return NULL;
+}
+
+int decompress_container(FILE *fin, int version, const char *output, int threads) {
+    Container c;
+    if (read_container(fin, version, &c) < 0) return -1;
+
+    BlockJob job;
+    job.index = c.index;
+    job.raw_offset = c.raw_offset;
+    uint32_t n_blocks = c.n_blocks;
+
+    struct stat st;
+    fstat(fileno(fin), &st);
+    job.map_size = st.st_size;
+    job.map = mmap(NULL, job.map_size, PROT_READ, MAP_PRIVATE, fileno(fin), 0);
+    if (job.map == MAP_FAILED) {
+        perror("Cannot map input");
+        free_container(&c);
+        return -1;
+    }
+
+    job.out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job.out_fd < 0) {
+        perror("Cannot open output");
+        munmap((void *)job.map, job.map_size);
+        free_container(&c);
+        return -1;
+    }
+
+    job.n_blocks = n_blocks;
+    job.next_block = 0;
+    job.failed = 0;
+    job.decoded = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    double t0 = now_sec();
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++)
+        pthread_create(&tids[t], NULL, decompress_worker, &job);
+    for (int t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+    double secs = now_sec() - t0;
+
+    pthread_mutex_destroy(&job.lock);
+    close(job.out_fd);
+    munmap((void *)job.map, job.map_size);
+    free(tids);
+    free_container(&c);
+
+    if (job.failed) return -1;
+
+    printf("\nDecompression Complete\n");
+    printf("Decoded bytes: %llu (%u blocks, %d threads)\n",
+           (unsigned long long)job.decoded, n_blocks, threads);
+    printf("Throughput      : %.1f MB/s\n", job.decoded / secs / 1e6);
+    printf("Peak RSS        : %ld KiB\n", peak_rss_kib());
+    return 0;
+}
+
+/*
+ * Stream format (see main_compress.c):
+ *   "HZS1" | frames of { u32 raw_size, u32 comp_size, payload } | {0, 0}
+ * Frames are decoded one at a time, so memory stays at one block.
+ */
+int decompress_stream(FILE *fin, FILE *fout, FILE *log) {
+    uint8_t *src = NULL, *dst = NULL;
+    uint32_t src_cap = 0, dst_cap = 0;
+    uint64_t total = 0;
+    int rc = 0;
+
+    while (1) {
+        uint32_t sizes[2];
+        if (fread(sizes, sizeof(uint32_t), 2, fin) != 2) {
+            fprintf(log, "ERROR: Truncated stream.\n");
+            rc = -1;
+            break;
+        }
+        if (sizes[0] == 0) break;
+
+        if (sizes[1] > src_cap) src = realloc(src, src_cap = sizes[1]);
+        if (sizes[0] > dst_cap) dst = realloc(dst, dst_cap = sizes[0]);
+
+        if (!src || !dst || fread(src, 1, sizes[1], fin) != sizes[1] ||
+            decode_block(src, sizes[1], dst, sizes[0]) != sizes[0]) {
+            fprintf(log, "ERROR: Corrupt stream frame.\n");
+            rc = -1;
+            break;
+        }
+        fwrite(dst, 1, sizes[0], fout);
+        total += sizes[0];
+    }
+
+    free(src);
+    free(dst);
+    fflush(fout);
+    if (rc < 0) return rc;
+
+    fprintf(log, "\nDecompression Complete\n");
+    fprintf(log, "Decoded bytes: %llu\n", (unsigned long long)total);
+    return 0;
+}
+
+int container_version(const char *magic) {
+    if (memcmp(magic, CONTAINER_MAGIC, 4) == 0) return 2;
+    if (memcmp(magic, CONTAINER_MAGIC_V1, 4) == 0) return 1;
+    return 0;
+}
+
+// Copies raw bytes [offset, end) of one container block to ob.
+int range_block(FILE *fin, const Container *c, uint32_t i,
+                uint64_t offset, uint64_t end, OutBuf *ob) {
+    BlockEntry *e = &c->index[i];
+    uint64_t block_start = c->raw_offset[i];
+    uint64_t rel = offset - block_start;
+    uint64_t stop = end - block_start;
+    if (stop > e->raw_size) stop = e->raw_size;
+
+    // Start at the nearest seek mark at or before the requested offset
+    uint64_t m = c->seek_interval ? rel / c->seek_interval : 0;
+    uint64_t start_bit = m ? c->seek[(uint64_t)i * c->marks_per_block + m - 1] : 0;
+    uint64_t mark_raw = m * c->seek_interval;
+
+    uint8_t *src = malloc(e->comp_size ? e->comp_size : 1);
+    fseek(fin, (long)e->offset, SEEK_SET);
+    if (fread(src, 1, e->comp_size, fin) != e->comp_size) {
+        free(src);
+        return -1;
+    }
+    FILE *fm = fmemopen(src, e->comp_size, "rb");
+    if (!fm) {
+        free(src);
+        return -1;
+    }
+
+    ob->discard = rel - mark_raw;
+    uint64_t want = stop - mark_raw;
+    int64_t decoded = decode_stream_at(fm, ob, 0, start_bit, want);
+    ob_flush(ob);
+    fclose(fm);
+    free(src);
+    return decoded == (int64_t)want ? 0 : -1;
+}
+
+// Decodes raw bytes [offset, offset + length) to output.
+int decompress_range(const char *input, const char *output,
+                     uint64_t offset, uint64_t length) {
+    FILE *fin = fopen(input, "rb");
+    if (!fin) { perror("Cannot open input"); return -1; }
+
+    FILE *fout = stdout;
+    if (strcmp(output, "-") != 0 && !(fout = fopen(output, "wb"))) {
+        perror("Cannot open output");
+        fclose(fin);
+        return -1;
+    }
+    FILE *log = fout == stdout ? stderr : stdout;
+
+    OutBuf ob;
+    ob_init(&ob, fout);
+    uint64_t end = offset + length;
+    int rc = 0;
+
+    char magic[4] = {0};
+    fread(magic, 1, 4, fin);
+    int version = container_version(magic);
+
+    if (version) {
+        Container c;
+        if (read_container(fin, version, &c) < 0) {
+            rc = -1;
+        } else {
+            if (end > c.orig_size) end = c.orig_size;
+            uint64_t pos = offset;
+            while (pos < end && rc == 0) {
+                uint32_t i = (uint32_t)(pos / c.block_size);
+                rc = range_block(fin, &c, i, pos, end, &ob);
+                pos = c.raw_offset[i] + c.index[i].raw_size;
+            }
+            free_container(&c);
+        }
+    } else if (memcmp(magic, STREAM_MAGIC, 4) == 0) {
+        // No index: skip whole frames by their sizes, decode the overlap
+        uint64_t pos = 0;
+        uint32_t sizes[2];
+        while (pos < end && fread(sizes, sizeof(uint32_t), 2, fin) == 2 && sizes[0]) {
+            if (pos + sizes[0] <= offset) {
+                fseek(fin, sizes[1], SEEK_CUR);
+            } else {
+                uint8_t *src = malloc(sizes[1]), *dst = malloc(sizes[0]);
+                if (!src || !dst || fread(src, 1, sizes[1], fin) != sizes[1] ||
+                    decode_block(src, sizes[1], dst, sizes[0]) != sizes[0]) {
+                    rc = -1;
+                } else {
+                    uint64_t from = offset > pos ? offset - pos : 0;
+                    uint64_t to = end - pos < sizes[0] ? end - pos : sizes[0];
+                    fwrite(dst + from, 1, to - from, fout);
+                }
+                free(src);
+                free(dst);
+                if (rc < 0) break;
+            }
+            pos += sizes[0];
+        }
+    } else {
+        // Single stream: no index, decode from the start and drop the prefix
+        fprintf(log, "No seek index; decoding from the start.\n");
+        rewind(fin);
+        ob.discard = offset;
+        if (decode_stream_at(fin, &ob, 0, 0, end) < 0) rc = -1;
+    }
+
+    ob_free(&ob);
+    fclose(fin);
+    if (fout != stdout) fclose(fout);
+    else fflush(stdout);
+
+    if (rc < 0) fprintf(log, "ERROR: Range decode failed.\n");
+    return rc;
+}
+
+int decompress_file(const char *input, const char *output, int threads) {
+    if (strcmp(input, "-") == 0) {
+        // Only the stream format can be decoded without seeking
+        char magic[4] = {0};
+        if (fread(magic, 1, 4, stdin) != 4 || memcmp(magic, STREAM_MAGIC, 4) != 0) {
+            fprintf(stderr, "ERROR: stdin is not an HZS1 stream.\n");
+            return -1;
+        }
+        FILE *fout = stdout;
+        if (strcmp(output, "-") != 0 && !(fout = fopen(output, "wb"))) {
+            perror("Cannot open output");
+            return -1;
+        }
+        int rc = decompress_stream(stdin, fout, fout == stdout ? stderr : stdout);
+        if (fout != stdout) fclose(fout);
+        return rc;
+    }
+
+    FILE *fin = fopen(input, "rb");
+    if (!fin) { perror("Cannot open input"); return -1; }
+
+    char magic[4] = {0};
+    fread(magic, 1, 4, fin);
+    int version = container_version(magic);
+    if (version) {
+        int rc = decompress_container(fin, version, output, threads);
+        fclose(fin);
+        return rc;
+    }
+    if (memcmp(magic, STREAM_MAGIC, 4) == 0) {
+        FILE *fout = fopen(output, "wb");
+        if (!fout) { perror("Cannot open output"); fclose(fin); return -1; }
+        int rc = decompress_stream(fin, fout, stdout);
+        fclose(fin);
+        fclose(fout);
+        return rc;
+    }
+    rewind(fin);
+
+    FILE *fout = fopen(output, "wb");
+    if (!fout) { perror("Cannot open output"); fclose(fin); return -1; }
+
+    double t0 = now_sec();
+    table_secs = 0;
+    OutBuf ob;
+    ob_init(&ob, fout);
+    int64_t decoded = decode_stream(fin, &ob, 0);
+    ob_free(&ob);
 
     fclose(fin);
     fclose(fout);
-    free_tree(root);
+    double secs = now_sec() - t0;
+    if (decoded < 0) return -1;
 
     printf("\nDecompression Complete\n");
     printf("Decoded bytes: %llu\n", (unsigned long long)decoded);
+    printf("Table build time: %.4f s\n", table_secs);
+    printf("Decode time     : %.4f s\n", secs - table_secs);
+    printf("Throughput      : %.1f MB/s\n", decoded / secs / 1e6);
+    printf("Peak RSS        : %ld KiB\n", peak_rss_kib());
     return 0;
 }
 
+int same_contents(FILE *a, FILE *b) {
+    uint8_t *ba = malloc(IO_BUF_SIZE), *bb = malloc(IO_BUF_SIZE);
+    int same = 1;
+    rewind(a);
+    rewind(b);
+    while (same) {
+        size_t na = fread(ba, 1, IO_BUF_SIZE, a);
+        size_t nb = fread(bb, 1, IO_BUF_SIZE, b);
+        if (na != nb || memcmp(ba, bb, na) != 0) same = 0;
+        if (na == 0) break;
+    }
+    free(ba);
+    free(bb);
+    return same;
+}
+
+// Decodes the file with both decoders and reports throughput of each.
+int bench_file(const char *input) {
+    FILE *fin = fopen(input, "rb");
+    if (!fin) { perror("Cannot open input"); return -1; }
+
+    char magic[4] = {0};
+    fread(magic, 1, 4, fin);
+    if (container_version(magic) || memcmp(magic, STREAM_MAGIC, 4) == 0) {
+        fprintf(stderr, "--bench takes a single-stream file, not a container or stream.\n");
+        fclose(fin);
+        return -1;
+    }
+    int lanes = memcmp(magic, PAYLOAD_X4_MAGIC, 4) == 0;
+    const char *names[2] = {"tree walk", "lookup table"};
+    if (lanes) {
+        names[0] = "lane by lane";
+        names[1] = "interleaved";
+    }
+    FILE *outs[2];
+    int64_t decoded[2];
+    double secs[2];
+
+    for (int m = 0; m < 2; m++) {
+        outs[m] = tmpfile();
+        rewind(fin);
+        double t0 = now_sec();
+        OutBuf ob;
+        ob_init(&ob, outs[m]);
+        decoded[m] = decode_stream(fin, &ob, m == 0);
+        ob_free(&ob);
+        fflush(outs[m]);
+        secs[m] = now_sec() - t0;
+    }
+    fclose(fin);
+
+    if (decoded[0] < 0 || decoded[1] < 0) {
+        fprintf(stderr, "ERROR: Decode failed; nothing to compare.\n");
+        fclose(outs[0]);
+        fclose(outs[1]);
+        return -1;
+    }
+
+    printf("\nDecoder Benchmark\n");
+    for (int m = 0; m < 2; m++)
+        printf("%-13s: %llu bytes in %.3f s  (%.1f MB/s)\n", names[m],
+               (unsigned long long)decoded[m], secs[m],
+               decoded[m] / secs[m] / 1e6);
+
+    int ok = decoded[0] == decoded[1] && same_contents(outs[0], outs[1]);
+    printf("Outputs identical: %s\n", ok ? "yes" : "NO");
+
+    fclose(outs[0]);
+    fclose(outs[1]);
+    return ok ? 0 : -1;
+}
+
+void usage(const char *prog) {
+    printf("Usage: %s [-j threads] [-o output] <compressed.log>\n", prog);
+    printf("       %s --bench <compressed.log>\n", prog);
+    printf("       %s --range offset:len [-o output] <compressed.log>\n", prog);
+    printf("  input '-' decodes an HZS1 stream from stdin (to stdout unless -o)\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <compressed.log>\n", argv[0]);
+    const char *input = NULL;
+    const char *output = NULL;
+    int threads = 0;
+    int bench = 0;
+    int range = 0;
+    uint64_t range_off = 0, range_len = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0)
+            bench = 1;
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+            char *sep;
+            range = 1;
+            range_off = strtoull(argv[++i], &sep, 10);
+            range_len = (*sep == ':') ? strtoull(sep + 1, NULL, 10) : 0;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+            input = argv[i];
+    }
+
+    if (!input) {
+        usage(argv[0]);
         return 1;
     }
 
-    decompress_file(argv[1], "decompressed.log");
-    return 0;
+    if (bench)
+        return bench_file(input) == 0 ? 0 : 1;
+
+    if (range)
+        return decompress_range(input, output ? output : "-",
+                                range_off, range_len) == 0 ? 0 : 1;
+
+    if (!output)
+        output = strcmp(input, "-") == 0 ? "-" : "decompressed.log";
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    return decompress_file(input, output, threads) == 0 ? 0 : 1;
 }